@@ -0,0 +1,105 @@
+#pragma once
+#include "NeuralNet.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+/// Coefficients of the activation approximations.
+/**
+   Shared by the functors below and the vector kernels, so that both
+     compute the same approximation.  See Activation for the errors.
+ */
+struct ActivationCoefficients {
+  // exp(x) = 2^n * exp(r), with x = n*ln(2) + r.  ln(2) is split in
+  // two so that r is exact, and exp(r) is a polynomial.  x is clamped
+  // so that 2^n is always a normal float.
+  static constexpr float exp_lo = -87.0f;
+  static constexpr float exp_hi = 87.0f;
+  static constexpr float log2e = 1.44269504088896341f;
+  static constexpr float ln2_hi = 0.693359375f;
+  static constexpr float ln2_lo = -2.12194440e-4f;
+  static constexpr float exp_p0 = 1.9875691500e-4f;
+  static constexpr float exp_p1 = 1.3981999507e-3f;
+  static constexpr float exp_p2 = 8.3334519073e-3f;
+  static constexpr float exp_p3 = 4.1665795894e-2f;
+  static constexpr float exp_p4 = 1.6666665459e-1f;
+  static constexpr float exp_p5 = 5.0000001201e-1f;
+
+  // [7/6] Pade approximant of tanh, clamped where it is closest to 1.
+  static constexpr float tanh_clamp = 4.9f;
+  static constexpr float tanh_n0 = 135135.0f;
+  static constexpr float tanh_n1 = 17325.0f;
+  static constexpr float tanh_n2 = 378.0f;
+  static constexpr float tanh_d0 = 135135.0f;
+  static constexpr float tanh_d1 = 62370.0f;
+  static constexpr float tanh_d2 = 3150.0f;
+  static constexpr float tanh_d3 = 28.0f;
+};
+
+/// Single precision exp, without calls to libm.
+inline _float_ activation_exp(_float_ x) {
+  typedef ActivationCoefficients C;
+  const float lo = C::exp_lo;
+  const float hi = C::exp_hi;
+  x = std::min(std::max(x, lo), hi);
+
+  // Adding and removing 1.5*2^23 rounds to the nearest integer.
+  const float shifter = 12582912.0f;
+  float n = (x*C::log2e + shifter) - shifter;
+  float r = x - n*C::ln2_hi;
+  r = r - n*C::ln2_lo;
+  float p = ((((C::exp_p0*r + C::exp_p1)*r + C::exp_p2)*r + C::exp_p3)*r + C::exp_p4)*r + C::exp_p5;
+  float y = p*(r*r) + (r + 1.0f);
+
+  uint32_t bits = uint32_t(int32_t(n) + 127) << 23;
+  float scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return y*scale;
+}
+
+/// Activation policies for NeuralNet_CRTP.
+/**
+   A policy is a default-constructible functor, mapping the summed input
+     of a node to its value.  Since the policy is part of the type of the
+     network, it is inlined into the evaluation loops.  The built-in
+     policies avoid calls to libm, so that the compiler may vectorize
+     those loops.  (GCC does so at -O3 with -fno-trapping-math, without
+     which it will not evaluate the division for clamped inputs.)  Any
+     other functor with the same signature may be used as a custom
+     activation.
+ */
+struct LogisticActivation {
+  _float_ operator()(_float_ x) const { return 1.0f/(1.0f + activation_exp(-x)); }
+};
+
+struct LogisticFastActivation {
+  _float_ operator()(_float_ x) const {
+    typedef ActivationCoefficients C;
+    const float clamp = C::tanh_clamp;
+    float t = std::min(std::max(0.5f*x, -clamp), clamp);
+    float t2 = t*t;
+    float num = t*(C::tanh_n0 + t2*(C::tanh_n1 + t2*(C::tanh_n2 + t2)));
+    float den = C::tanh_d0 + t2*(C::tanh_d1 + t2*(C::tanh_d2 + t2*C::tanh_d3));
+    return 0.5f*(num/den) + 0.5f;
+  }
+};
+
+struct TanhActivation {
+  _float_ operator()(_float_ x) const { return 1.0f - 2.0f/(1.0f + activation_exp(2.0f*x)); }
+};
+
+struct SoftsignActivation {
+  _float_ operator()(_float_ x) const { return x/(1.0f + std::abs(x)); }
+};
+
+struct ReLUActivation {
+  _float_ operator()(_float_ x) const { return x > 0.0f ? x : 0.0f; }
+};
+
+/// Default policy, choosing the activation when the network is built.
+/**
+   Uses the function selected with NeuralNet::set_activation, applied by
+     the vectorized kernels of Kernels.hh.
+ */
+struct RuntimeActivation { };
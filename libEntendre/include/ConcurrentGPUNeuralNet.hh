@@ -1,5 +1,7 @@
 #pragma once
 #include "NeuralNet.hh"
+#include "ExecutionPlan.hh"
+#include "LoopDetector.hh"
 
 #include <vector>
 #include <stdexcept>
@@ -13,10 +15,13 @@ public:
 
   virtual void add_node(const NodeType& type);
   virtual void add_connection(int origin, int dest, _float_ weight, unsigned int set=std::numeric_limits<unsigned int>::max());
+  virtual void add_connections(Span<const Connection> connections);
+  virtual void add_sorted_connections(Span<const Connection> connections);
   virtual unsigned int num_nodes() { return nodes.size(); }
   virtual unsigned int num_connections() { return connections.size(); }
   virtual std::vector<_float_> host_evaluate(std::vector<_float_> inputs);
-  std::vector<_float_> evaluate(std::vector<_float_> inputs);
+  using NeuralNet::evaluate;
+  void evaluate(Span<const _float_> inputs, Span<_float_> outputs) override;
 
   virtual std::unique_ptr<NeuralNet> clone() const {
     return std::unique_ptr<ConcurrentGPUNeuralNet>(new ConcurrentGPUNeuralNet(*this));
@@ -27,40 +32,28 @@ public:
   virtual Connection get_connection(unsigned int i) const {
     return connections[i];
   }
+  virtual unsigned int added_index(unsigned int i) const { return added_order[i]; }
   virtual NodeType get_node_type(unsigned int i) const {
-    return (i<num_inputs) ? NodeType::Input :
-      (i >= nodes.size()-num_outputs) ? NodeType::Output : NodeType::Hidden;
+    return node_types[i];
   }
+  virtual unsigned int num_outputs() const { return n_outputs; }
   virtual void sort_connections(unsigned int first=0, unsigned int num_connections=0);
+  virtual void set_weights(Span<const _float_> weights);
+  virtual void reset_state();
   std::vector<Connection>& get_connections() { return connections; }
   void set_threads_per_block(size_t nthreads) { num_threads = nthreads; }
 
 private:
   bool would_make_loop(unsigned int i, unsigned int j, unsigned int set=std::numeric_limits<unsigned int>::max());
-  void build_action_list();
   void synchronize();
 
-
-  enum class EvaluationOrder { GreaterThan, LessThan, Unknown };
-  EvaluationOrder compare_connections(const Connection& a, const Connection& b);
-
-  size_t num_inputs = 0;
-  size_t num_outputs = 0;
-
-  struct Connections {
-    Connections() { ; }
-    std::vector<unsigned int> origin;
-    std::vector<unsigned int> dest;
-    std::vector<_float_> weight;
-    Connections(size_t size) { origin.reserve(size); dest.reserve(size); weight.reserve(size); }
-    inline unsigned int size() const { return origin.size(); }
-    inline void add(int origin, int dest, _float_ weight) { this->origin.push_back(origin); this->dest.push_back(dest); this->weight.push_back(weight); }
-  };
-
+  std::vector<NodeType> node_types;
+  unsigned int n_outputs = 0;
   std::vector<_float_> nodes;
   std::vector<Connection> connections;
-  Connections connection_list;
-  std::vector<unsigned int> action_list;
+  std::vector<unsigned int> added_order;
+  LoopDetector loop_detector;
+  ExecutionPlan plan;
 
   // device pointers
   unsigned int num_threads=32;
@@ -68,7 +61,8 @@ private:
   unsigned int* origin_ = nullptr;
   unsigned int* dest_ = nullptr;
   _float_* weight_ = nullptr;
-  unsigned int* action_list_ = nullptr;
+  unsigned int* zero_out_ = nullptr;
+  unsigned int* sigmoid_ = nullptr;
 };
 
 #else
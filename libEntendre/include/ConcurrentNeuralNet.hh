@@ -1,44 +1,296 @@
 #pragma once
 #include "NeuralNet_CRTP.hh"
+#include "ConnectionScheduler.hh"
+#include "ExecutionPlan.hh"
+#include "Kernels.hh"
 
 #include <vector>
 #include <stdexcept>
 #include <functional>
+#include <cassert>
+#include <sstream>
+#include <algorithm>
 
-class ConcurrentNeuralNet : public NeuralNet_CRTP<ConcurrentNeuralNet> {
-  friend class NeuralNet_CRTP;
+/// Network evaluated level by level, each level applying connections that do not conflict.
+/**
+   ActivationPolicy is the activation of hidden and output nodes, see
+     NeuralNet_CRTP.  ConcurrentNeuralNet chooses it at runtime.
+ */
+template<typename ActivationPolicy>
+class BasicConcurrentNeuralNet : public NeuralNet_CRTP<BasicConcurrentNeuralNet<ActivationPolicy>, ActivationPolicy> {
+  friend class NeuralNet_CRTP<BasicConcurrentNeuralNet, ActivationPolicy>;
 public:
   //using NeuralNet::NeuralNet;
-  virtual ~ConcurrentNeuralNet() { ; }
+  virtual ~BasicConcurrentNeuralNet() { ; }
 
   void sort_connections(unsigned int first=0, unsigned int num_connections=0) override;
-  std::vector<_float_> evaluate(std::vector<_float_> inputs);
+  void set_weights(Span<const _float_> weights) override;
+  void reset_state() override;
+  using NeuralNet::evaluate;
+  void evaluate(Span<const _float_> inputs, Span<_float_> outputs) override;
+
+  /// Evaluates a batch of independent samples in one pass over the action list.
+  /**
+     inputs is a row-major (batch_size x num_inputs) matrix, where each row
+       holds the inputs for one sample, excluding the bias node.
+     Returns a row-major (batch_size x num_outputs) matrix.
+
+     Each row is evaluated on its own copy of the node values, so recurrent
+       state is carried forward per row across consecutive calls that use
+       the same batch_size.  When the batch size changes, every row starts
+       from the current state of the single-sample network.
+   */
+  std::vector<_float_> evaluate_batch(const std::vector<_float_>& inputs, unsigned int batch_size);
   virtual void add_node(const NodeType& type);
 
 
   virtual Connection get_connection(unsigned int i) const {
-    return connections[i];
+    return this->table().connections[i];
   }
   virtual NodeType get_node_type(unsigned int i) const {
-    return (i<num_inputs) ? NodeType::Input :
-      (i >= nodes.size()-num_outputs) ? NodeType::Output : NodeType::Hidden;
+    return node_types[i];
   }
+  virtual unsigned int num_outputs() const { return n_outputs; }
 
   virtual void print_network(std::ostream& os) const override;
 private:
-  void clear_nodes(unsigned int* list, unsigned int n);
-  void sigmoid_nodes(unsigned int* list, unsigned int n);
-  void apply_connections(Connection* list, unsigned int n);
-  void build_action_list();
+  void clear_nodes(const unsigned int* list, unsigned int n);
+  void clear_nodes_batch(const unsigned int* list, unsigned int n);
+  void sigmoid_nodes_batch(const unsigned int* list, unsigned int n);
+  void apply_connections_batch(const unsigned int* origin, const unsigned int* dest, const _float_* weight, unsigned int n);
 
+  std::vector<NodeType> node_types;
+  unsigned int n_outputs = 0;
+  std::vector<_float_> nodes;
+  // Shared between copies, like the connections.
+  std::shared_ptr<ExecutionPlan> shared_plan = std::make_shared<ExecutionPlan>();
 
-  enum class EvaluationOrder { GreaterThan, LessThan, Unknown };
-  EvaluationOrder compare_connections(const Connection& a, const Connection& b);
+  // node-major batch state, batch_nodes[node*batch_size + sample]
+  unsigned int batch_size = 0;
+  std::vector<_float_> batch_nodes;
+};
 
-  size_t num_inputs = 0;
-  size_t num_outputs = 0;
 
-  std::vector<_float_> nodes;
-  std::vector<Connection> connections;
-  std::vector<unsigned int> action_list;
-};
+template<typename ActivationPolicy>
+void BasicConcurrentNeuralNet<ActivationPolicy>::sort_connections(unsigned int first, unsigned int num_connections) {
+  if(this->connections_sorted) {
+    return;
+  }
+
+  // if the first connection in the list to sort is not
+  // the first connection, and num_connections is zero
+  // this is an error
+  auto& table = this->mutable_table();
+  auto& connections = table.connections;
+
+  assert(!(first!=0 && num_connections==0));
+  // if num_connections is zero, then we will sort all connections
+  num_connections = num_connections > 0 ? num_connections : connections.size();
+  // the number of connections to sort cannot be
+  // larger than the total number of connections
+  assert(first+num_connections <= connections.size());
+
+  schedule_connection_sets(connections.data()+first, num_connections, table.added_order.data()+first);
+
+  // build the action list if num_connections was the total set
+  // or if this is the last subset of connections (all others are sorted)
+  if (first + num_connections == connections.size()) {
+    // if first is nonzero then we have been sorting based on subsets and now all subset lock free buckets
+    // need to be merged in a sort of the entire connections list where set now is the lock free set index
+    // (before it was used as the subnet index)
+    if (first != 0) {
+      // sort connections based on evaluation set number if not already done
+      sort_by_set(connections.data(), connections.size(), table.added_order.data());
+    }
+
+
+    shared_plan = std::make_shared<ExecutionPlan>(node_types, connections);
+    this->connections_sorted = true; // we are done sorting
+  }
+
+}
+
+template<typename ActivationPolicy>
+void BasicConcurrentNeuralNet<ActivationPolicy>::set_weights(Span<const _float_> weights) {
+  auto& table = this->mutable_table();
+  auto& connections = table.connections;
+  assert(weights.size() == connections.size());
+  for(auto i=0u; i<connections.size(); i++) {
+    connections[i].weight = weights[table.added_order[i]];
+  }
+  // the plan holds the connections in the same order
+  if(this->connections_sorted) {
+    auto& plan = this->unshare(shared_plan);
+    for(auto i=0u; i<connections.size(); i++) {
+      plan.set_weight(i, connections[i].weight);
+    }
+  }
+}
+
+template<typename ActivationPolicy>
+void BasicConcurrentNeuralNet<ActivationPolicy>::reset_state() {
+  for(auto i=0u; i<nodes.size(); i++) {
+    nodes[i] = node_types[i] == NodeType::Bias ? 1.0 : 0.0;
+  }
+  batch_size = 0;
+  batch_nodes.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////
+
+template<typename ActivationPolicy>
+void BasicConcurrentNeuralNet<ActivationPolicy>::add_node(const NodeType& type) {
+  node_types.push_back(type);
+  n_outputs += IsOutput(type);
+  nodes.push_back(type == NodeType::Bias ? 1.0 : 0.0);
+}
+
+template<typename ActivationPolicy>
+void BasicConcurrentNeuralNet<ActivationPolicy>::clear_nodes(const unsigned int* list, unsigned int n) {
+  for(auto i=0u; i<n; i++) {
+    nodes[list[i]] = 0;
+  }
+}
+
+template<typename ActivationPolicy>
+void BasicConcurrentNeuralNet<ActivationPolicy>::evaluate(Span<const _float_> inputs, Span<_float_> outputs) {
+  sort_connections();
+  auto& plan = *shared_plan;
+  auto& input_nodes = plan.input_nodes();
+  assert(inputs.size() == input_nodes.size());
+
+  // copy inputs in to network
+  for(auto k=0u; k<input_nodes.size(); k++) {
+    nodes[input_nodes[k]] = inputs[k];
+  }
+
+  for(auto step=0u; step<=plan.num_levels(); step++) {
+    clear_nodes(plan.zero_out_nodes(step), plan.num_zero_out(step));
+    this->activate_nodes(nodes.data(), plan.sigmoid_nodes(step), plan.num_sigmoid(step));
+    if(step < plan.num_levels()) {
+      auto first = plan.level_begin(step);
+      kernel_apply_connections(nodes.data(), plan.origins()+first, plan.dests()+first, plan.weights()+first, plan.level_size(step));
+    }
+  }
+
+  auto& output_nodes = plan.output_nodes();
+  assert(outputs.size() == output_nodes.size());
+  for(auto k=0u; k<output_nodes.size(); k++) {
+    outputs[k] = nodes[output_nodes[k]];
+  }
+}
+
+template<typename ActivationPolicy>
+void BasicConcurrentNeuralNet<ActivationPolicy>::clear_nodes_batch(const unsigned int* list, unsigned int n) {
+  for(auto i=0u; i<n; i++) {
+    _float_* node = &batch_nodes[list[i]*batch_size];
+    std::fill(node, node+batch_size, 0);
+  }
+}
+
+template<typename ActivationPolicy>
+void BasicConcurrentNeuralNet<ActivationPolicy>::sigmoid_nodes_batch(const unsigned int* list, unsigned int n) {
+  for(auto i=0u; i<n; i++) {
+    this->activate_values(&batch_nodes[list[i]*batch_size], batch_size);
+  }
+}
+
+template<typename ActivationPolicy>
+void BasicConcurrentNeuralNet<ActivationPolicy>::apply_connections_batch(const unsigned int* origin, const unsigned int* dest, const _float_* weight, unsigned int n) {
+  for(auto i=0u; i<n; i++) {
+    const _float_ w = weight[i];
+    _float_* dest_row = &batch_nodes[dest[i]*batch_size];
+    if(origin[i] == dest[i]) {
+      // Special case for self-recurrent nodes
+      for(auto b=0u; b<batch_size; b++) {
+        dest_row[b] *= w;
+      }
+    } else {
+      // Connections within a set never share a destination,
+      // so the origin and destination rows never alias.
+      const _float_* origin_row = &batch_nodes[origin[i]*batch_size];
+      for(auto b=0u; b<batch_size; b++) {
+        dest_row[b] += w*origin_row[b];
+      }
+    }
+  }
+}
+
+template<typename ActivationPolicy>
+std::vector<_float_> BasicConcurrentNeuralNet<ActivationPolicy>::evaluate_batch(const std::vector<_float_>& inputs, unsigned int batch_size) {
+  sort_connections();
+  auto& plan = *shared_plan;
+  auto& input_nodes = plan.input_nodes();
+  auto& output_nodes = plan.output_nodes();
+  assert(inputs.size() == batch_size*input_nodes.size());
+
+  // (re)initialize the per-sample state from the single-sample network
+  if(batch_size != this->batch_size) {
+    this->batch_size = batch_size;
+    batch_nodes.resize(nodes.size()*batch_size);
+    for(auto n=0u; n<nodes.size(); n++) {
+      std::fill(&batch_nodes[n*batch_size], &batch_nodes[n*batch_size]+batch_size, nodes[n]);
+    }
+  }
+
+  // copy inputs in to network, transposing to node-major order
+  const auto row_length = input_nodes.size();
+  for(auto b=0u; b<batch_size; b++) {
+    for(auto k=0u; k<row_length; k++) {
+      batch_nodes[input_nodes[k]*batch_size + b] = inputs[b*row_length + k];
+    }
+  }
+
+  for(auto step=0u; step<=plan.num_levels(); step++) {
+    clear_nodes_batch(plan.zero_out_nodes(step), plan.num_zero_out(step));
+    sigmoid_nodes_batch(plan.sigmoid_nodes(step), plan.num_sigmoid(step));
+    if(step < plan.num_levels()) {
+      auto first = plan.level_begin(step);
+      apply_connections_batch(plan.origins()+first, plan.dests()+first, plan.weights()+first, plan.level_size(step));
+    }
+  }
+
+  // copy outputs out of the network, transposing back to row-major order
+  const auto num_outputs = output_nodes.size();
+  std::vector<_float_> outputs(batch_size*num_outputs);
+  for(auto k=0u; k<num_outputs; k++) {
+    const _float_* node = &batch_nodes[output_nodes[k]*batch_size];
+    for(auto b=0u; b<batch_size; b++) {
+      outputs[b*num_outputs + k] = node[b];
+    }
+  }
+
+  return outputs;
+}
+
+
+template<typename ActivationPolicy>
+void BasicConcurrentNeuralNet<ActivationPolicy>::print_network(std::ostream& os) const {
+  auto& plan = *shared_plan;
+  std::stringstream ss; ss.str("");
+  ss << "Action List: \n\n";
+
+  for(auto step=0u; step<=plan.num_levels(); step++) {
+    ss << "# Zero out: " << plan.num_zero_out(step) << "\n";
+    ss << "# Sigmoid: " << plan.num_sigmoid(step) << "\n";
+    if(step < plan.num_levels()) {
+      ss << "# Connections: " << plan.level_size(step) << "\n";
+    }
+  }
+  os << ss.str();
+
+  ss.str("");
+  ss << "\nConnection sets:\n";
+  for(auto level=0u; level<plan.num_levels(); level++) {
+    auto first = plan.level_begin(level);
+    for(auto i=first; i<first+plan.level_size(level); i++) {
+      ss << plan.origins()[i] << " -> " << plan.dests()[i] << "\n";
+    }
+    ss << "\n";
+  }
+
+  os << ss.str();
+}
+
+typedef BasicConcurrentNeuralNet<RuntimeActivation> ConcurrentNeuralNet;
+extern template class BasicConcurrentNeuralNet<RuntimeActivation>;
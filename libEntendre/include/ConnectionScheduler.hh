@@ -0,0 +1,43 @@
+#pragma once
+#include "NeuralNet.hh"
+
+#include <cstddef>
+
+/// Assigns lock-free evaluation sets to a range of connections.
+/**
+   On return, the set member of each connection in [connections,
+     connections+n) holds the earliest set in which the connection can
+     be applied, and the range is stably sorted by set number.
+
+   The ordering constraints between two connections a and b are, in
+     order of precedence,
+   - A recurrent connection must be used before its origin is overwritten.
+   - A normal connection must occur after every connection incoming
+     to its origin has completed, recurrent ones included, so that it
+     reads the activated value.  No connection reads a node that is
+     written in the same set.
+   - Two connections writing to the same destination must be in
+     different sets.  A self-recurrent connection comes first, then
+     connections are ordered by decreasing origin.
+
+   Set numbers are the longest-path depth of each connection in the
+     resulting dependency graph.  Rather than comparing every pair of
+     connections, the graph is built from per-node incoming and outgoing
+     lists, with one auxiliary vertex per node standing in for the
+     "all writes complete" and "all recurrent reads complete"
+     events, so the cost is O(n log n) in the number of connections.
+
+   If order is not null, it holds n values, which are permuted along
+     with the connections.
+
+   Throws std::runtime_error if the constraints cannot be satisfied.
+ */
+void schedule_connection_sets(Connection* connections, size_t n, unsigned int* order=nullptr);
+
+/// Stably sorts a range of connections by set number.
+/**
+   Used to merge ranges that were scheduled on their own.  If order is
+     not null, it holds n values, which are permuted along with the
+     connections.
+ */
+void sort_by_set(Connection* connections, size_t n, unsigned int* order=nullptr);
@@ -4,28 +4,46 @@
 #include <vector>
 #include <stdexcept>
 #include <functional>
+#include <cassert>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <sstream>
+#include <algorithm>
 
-
-class ConsecutiveNeuralNet : public NeuralNet_CRTP<ConsecutiveNeuralNet> {
-  friend class NeuralNet_CRTP;
+/// Network evaluated one connection at a time, in dependency order.
+/**
+   ActivationPolicy is the activation of hidden and output nodes, see
+     NeuralNet_CRTP.  ConsecutiveNeuralNet chooses it at runtime.
+ */
+template<typename ActivationPolicy>
+class BasicConsecutiveNeuralNet : public NeuralNet_CRTP<BasicConsecutiveNeuralNet<ActivationPolicy>, ActivationPolicy> {
+  friend class NeuralNet_CRTP<BasicConsecutiveNeuralNet, ActivationPolicy>;
 public:
   //using NeuralNet::NeuralNet;
-  virtual ~ConsecutiveNeuralNet() { ; }
+  virtual ~BasicConsecutiveNeuralNet() { ; }
 
-  void load_input_vals(const std::vector<_float_>& inputs);
-  std::vector<_float_> read_output_vals();
-  virtual std::vector<_float_> evaluate(std::vector<_float_> inputs);
+  void load_input_vals(Span<const _float_> inputs);
+  void read_output_vals(Span<_float_> outputs);
+  using NeuralNet::evaluate;
+  void evaluate(Span<const _float_> inputs, Span<_float_> outputs) override;
 
   std::vector<NodeType> node_types() const;
-  virtual void add_node(const NodeType& type) { nodes.emplace_back(type); }
+  virtual void add_node(const NodeType& type) {
+    nodes.emplace_back(type);
+    n_outputs += IsOutput(type);
+  }
+  virtual unsigned int num_outputs() const { return n_outputs; }
 
   virtual Connection get_connection(unsigned int i) const {
-    return connections[i];
+    return this->table().connections[i];
   }
   virtual NodeType get_node_type(unsigned int i) const {
     return nodes[i].type;
   }
   void sort_connections(unsigned int first=0, unsigned int num_connections=0) override;
+  void set_weights(Span<const _float_> weights) override;
+  void reset_state() override;
 
   virtual void print_network(std::ostream& os) const;
 
@@ -37,5 +55,317 @@ private:
 
 
   std::vector<Node> nodes;
-  std::vector<Connection> connections;
+  unsigned int n_outputs = 0;
 };
+
+template<typename ActivationPolicy>
+void BasicConsecutiveNeuralNet<ActivationPolicy>::evaluate(Span<const _float_> inputs, Span<_float_> outputs) {
+  sort_connections();
+  load_input_vals(inputs);
+
+  for(auto& conn : this->table().connections) {
+    _float_ input_val = get_node_val(conn.origin);
+    add_to_val(conn.dest, input_val * conn.weight);
+  }
+
+  read_output_vals(outputs);
+}
+
+template<typename ActivationPolicy>
+void BasicConsecutiveNeuralNet<ActivationPolicy>::load_input_vals(Span<const _float_> inputs) {
+  size_t input_index = 0;
+
+  for(auto& node : nodes) {
+    switch(node.type) {
+    case NodeType::Input:
+      if(input_index < inputs.size()) {
+        node.value = inputs[input_index];
+      } else {
+        node.value = 0;
+      }
+      node.is_sigmoid = true;
+      input_index++;
+      break;
+
+    case NodeType::Bias:
+      node.value = 1;
+      node.is_sigmoid = true;
+      break;
+
+    default:
+      break;
+    }
+  }
+}
+
+template<typename ActivationPolicy>
+void BasicConsecutiveNeuralNet<ActivationPolicy>::read_output_vals(Span<_float_> outputs) {
+  assert(outputs.size() == n_outputs);
+  size_t output_index = 0;
+  for(size_t i=0; i<nodes.size(); i++) {
+    if(nodes[i].type == NodeType::Output) {
+      outputs[output_index++] = get_node_val(i);
+    }
+  }
+}
+
+template<typename ActivationPolicy>
+_float_ BasicConsecutiveNeuralNet<ActivationPolicy>::get_node_val(unsigned int i) {
+  if(!nodes[i].is_sigmoid) {
+    nodes[i].value = this->activate(nodes[i].value);
+    nodes[i].is_sigmoid = true;
+  }
+  return nodes[i].value;
+}
+
+template<typename ActivationPolicy>
+void BasicConsecutiveNeuralNet<ActivationPolicy>::add_to_val(unsigned int i, _float_ val) {
+  if(nodes[i].is_sigmoid) {
+    nodes[i].value = 0;
+    nodes[i].is_sigmoid = false;
+  }
+  nodes[i].value += val;
+}
+
+template<typename ActivationPolicy>
+void BasicConsecutiveNeuralNet<ActivationPolicy>::sort_connections(unsigned int first, unsigned int num_connections) {
+  if(this->connections_sorted) {
+    return;
+  }
+
+  auto& table = this->mutable_table();
+  auto& connections = table.connections;
+
+  assert(!(first!=0 && num_connections==0));
+  num_connections = num_connections > 0 ? num_connections : connections.size();
+  assert(first+num_connections <= connections.size());
+
+  Connection* range = connections.data() + first;
+
+  // Renumber the nodes touched by this range, so that sorting a small
+  // subnet of a large composite net does not scale with the full net.
+  std::vector<unsigned int> node_ids;
+  node_ids.reserve(2*num_connections);
+  for(size_t i=0; i<num_connections; i++) {
+    node_ids.push_back(range[i].origin);
+    node_ids.push_back(range[i].dest);
+  }
+  std::sort(node_ids.begin(), node_ids.end());
+  node_ids.erase(std::unique(node_ids.begin(), node_ids.end()), node_ids.end());
+  const size_t num_nodes = node_ids.size();
+
+  auto local_id = [&](unsigned int id) {
+    return std::lower_bound(node_ids.begin(), node_ids.end(), id) - node_ids.begin();
+  };
+  std::vector<unsigned int> origin(num_connections);
+  std::vector<unsigned int> dest(num_connections);
+  for(size_t i=0; i<num_connections; i++) {
+    origin[i] = local_id(range[i].origin);
+    dest[i] = local_id(range[i].dest);
+  }
+
+  // Number of unused connections writing to each node, and number of
+  // unused recurrent connections reading from each node.
+  std::vector<unsigned int> num_unused_inputs(num_nodes, 0);
+  std::vector<unsigned int> num_unused_recurrent_outputs(num_nodes, 0);
+
+  // Connections indexed by origin and by destination.
+  std::vector<unsigned int> outgoing_offsets(num_nodes+1, 0);
+  std::vector<unsigned int> incoming_offsets(num_nodes+1, 0);
+
+  for(size_t i=0; i<num_connections; i++) {
+    num_unused_inputs[dest[i]]++;
+    if(range[i].type == ConnectionType::Recurrent) {
+      num_unused_recurrent_outputs[origin[i]]++;
+    }
+    outgoing_offsets[origin[i]+1]++;
+    incoming_offsets[dest[i]+1]++;
+  }
+  for(size_t i=0; i<num_nodes; i++) {
+    outgoing_offsets[i+1] += outgoing_offsets[i];
+    incoming_offsets[i+1] += incoming_offsets[i];
+  }
+  std::vector<unsigned int> outgoing(num_connections);
+  std::vector<unsigned int> incoming(num_connections);
+  {
+    std::vector<unsigned int> next_outgoing(outgoing_offsets.begin(), outgoing_offsets.end()-1);
+    std::vector<unsigned int> next_incoming(incoming_offsets.begin(), incoming_offsets.end()-1);
+    for(size_t i=0; i<num_connections; i++) {
+      outgoing[next_outgoing[origin[i]]++] = i;
+      incoming[next_incoming[dest[i]]++] = i;
+    }
+  }
+
+  auto is_ready = [&](unsigned int i) {
+    auto type = range[i].type;
+    // Origin of normal connection has no unused input connections
+    if(type == ConnectionType::Normal &&
+       num_unused_inputs[origin[i]] > 0) {
+      return false;
+    }
+    // Destination of connection has no unused recurrent output connections
+    // If the output recurrent connection is ourself, it is allowed.
+    unsigned int self_recurrent = (type == ConnectionType::Recurrent &&
+                                   origin[i] == dest[i]);
+    return num_unused_recurrent_outputs[dest[i]] == self_recurrent;
+  };
+
+  // Once ready, a connection stays ready, so always taking the
+  // lowest-indexed ready connection gives the same order as repeatedly
+  // scanning for the first connection that could be used next.
+  std::vector<bool> queued(num_connections, false);
+  std::priority_queue<unsigned int, std::vector<unsigned int>, std::greater<unsigned int> > ready;
+  auto try_queue = [&](unsigned int i) {
+    if(!queued[i] && is_ready(i)) {
+      queued[i] = true;
+      ready.push(i);
+    }
+  };
+
+  for(size_t i=0; i<num_connections; i++) {
+    try_queue(i);
+  }
+
+  std::vector<Connection> sorted;
+  std::vector<unsigned int> sorted_added;
+  sorted.reserve(num_connections);
+  sorted_added.reserve(num_connections);
+
+  while(!ready.empty()) {
+    unsigned int i = ready.top();
+    ready.pop();
+    Connection& conn = range[i];
+    sorted.push_back(conn);
+    sorted_added.push_back(table.added_order[first+i]);
+
+    // Last input to the destination, so normal connections reading it may go.
+    if(--num_unused_inputs[dest[i]] == 0) {
+      for(auto j=outgoing_offsets[dest[i]]; j<outgoing_offsets[dest[i]+1]; j++) {
+        try_queue(outgoing[j]);
+      }
+    }
+
+    // Connections writing to the origin may go once the recurrent
+    // outputs are used, or only a self-recurrent output remains.
+    if(conn.type == ConnectionType::Recurrent) {
+      unsigned int remaining = --num_unused_recurrent_outputs[origin[i]];
+      if(remaining <= 1) {
+        for(auto j=incoming_offsets[origin[i]]; j<incoming_offsets[origin[i]+1]; j++) {
+          try_queue(incoming[j]);
+        }
+      }
+    }
+  }
+
+  if(sorted.size() != num_connections) {
+    throw std::runtime_error("Sorting failed. Replace this with a class specific Exception");
+  }
+
+  // copy sorted connections into connections list
+  std::copy(sorted.begin(), sorted.end(), range);
+  std::copy(sorted_added.begin(), sorted_added.end(), table.added_order.begin()+first);
+
+  // if num_connections was the total set
+  // or if this is the last subset of connections
+  // then we are done (all others are sorted)
+  if (first + num_connections == connections.size()) {
+    // All nodes should start sigmoided.  Ranges may be sorted at the
+    // same time and share nodes, so only mark them here.
+    for(auto& conn : connections) {
+      nodes[conn.origin].is_sigmoid = true;
+      nodes[conn.dest].is_sigmoid = true;
+    }
+    this->connections_sorted = true;
+  }
+
+}
+
+template<typename ActivationPolicy>
+void BasicConsecutiveNeuralNet<ActivationPolicy>::set_weights(Span<const _float_> weights) {
+  auto& table = this->mutable_table();
+  assert(weights.size() == table.connections.size());
+  for(size_t i=0; i<table.connections.size(); i++) {
+    table.connections[i].weight = weights[table.added_order[i]];
+  }
+}
+
+template<typename ActivationPolicy>
+void BasicConsecutiveNeuralNet<ActivationPolicy>::reset_state() {
+  for(auto& node : nodes) {
+    node.value = 0;
+    node.is_sigmoid = false;
+  }
+  // as marked when sorting
+  if(this->connections_sorted) {
+    for(auto& conn : this->table().connections) {
+      nodes[conn.origin].is_sigmoid = true;
+      nodes[conn.dest].is_sigmoid = true;
+    }
+  }
+}
+
+template<typename ActivationPolicy>
+std::vector<NodeType> BasicConsecutiveNeuralNet<ActivationPolicy>::node_types() const {
+  std::vector<NodeType> output;
+
+  for(auto& node : nodes) {
+    output.push_back(node.type);
+  }
+
+  return output;
+}
+
+template<typename ActivationPolicy>
+void BasicConsecutiveNeuralNet<ActivationPolicy>::print_network(std::ostream& os) const {
+  std::map<unsigned int, std::string> names;
+  unsigned int num_inputs = 0;
+  unsigned int num_outputs = 0;
+  unsigned int num_hidden = 0;
+  for(unsigned int i=0; i<nodes.size(); i++) {
+    std::stringstream ss;
+    switch(nodes[i].type) {
+      case NodeType::Input:
+        ss << "I" << num_inputs++;
+        break;
+      case NodeType::Output:
+        ss << "O" << num_outputs++;
+        break;
+      case NodeType::Hidden:
+        ss << "H" << num_hidden++;
+        break;
+      case NodeType::Bias:
+        ss << "B";
+        break;
+
+      default:
+        std::cerr << "Type: " << int(nodes[i].type) << std::endl;
+        assert(false);
+        break;
+    }
+    names[i] = ss.str();
+  }
+
+  for(const auto& item : names) {
+    std::cout << "Node " << item.first << " = " << item.second << std::endl;
+  }
+
+  auto& connections = this->table().connections;
+  for(auto& conn : connections) {
+    os << names[conn.origin];
+    //os << conn.origin;
+    if(conn.type == ConnectionType::Normal) {
+      os << " ---> ";
+    } else {
+      os << " -R-> ";
+    }
+    os << names[conn.dest];
+    //os << conn.dest;
+
+    if(&conn != &connections.back()) {
+      os << "\n";
+    }
+  }
+}
+
+typedef BasicConsecutiveNeuralNet<RuntimeActivation> ConsecutiveNeuralNet;
+extern template class BasicConsecutiveNeuralNet<RuntimeActivation>;
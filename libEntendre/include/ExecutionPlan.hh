@@ -0,0 +1,76 @@
+#pragma once
+#include "NeuralNet.hh"
+
+#include <vector>
+
+/// Flattened evaluation schedule of a sorted network, fixed apart from its weights.
+/**
+   Evaluation is a sequence of num_levels()+1 steps.  Step i first
+     zeroes out the nodes in zero_out_nodes(i), then applies the
+     activation to the nodes in sigmoid_nodes(i), then, for
+     i<num_levels(), applies the connections of level i.
+
+   Connections within a level never share a destination, and are
+     stored as separate origin/dest/weight arrays so that applying a
+     level only touches the data needed for evaluation.  A connection
+     whose origin equals its destination scales the node rather than
+     adding to it.
+ */
+class ExecutionPlan {
+public:
+  ExecutionPlan() : level_offsets(1,0), zero_out_offsets(2,0), sigmoid_offsets(2,0) { ; }
+
+  /// Builds the plan from connections sorted by set number.
+  /**
+     node_types gives the type of each node in the network.  The set
+       member of each connection is its level.
+   */
+  ExecutionPlan(const std::vector<NodeType>& node_types,
+                const std::vector<Connection>& connections);
+
+  unsigned int num_nodes() const { return n_nodes; }
+  unsigned int num_levels() const { return level_offsets.size()-1; }
+  unsigned int num_connections() const { return origin.size(); }
+
+  /// First connection of a level, as an index into origins(), dests() and weights()
+  unsigned int level_begin(unsigned int level) const { return level_offsets[level]; }
+  unsigned int level_size(unsigned int level) const { return level_offsets[level+1] - level_offsets[level]; }
+
+  const unsigned int* origins() const { return origin.data(); }
+  const unsigned int* dests() const { return dest.data(); }
+  const _float_* weights() const { return weight.data(); }
+
+  /// Overwrites the weight of connection i, as numbered by weights()
+  void set_weight(unsigned int i, _float_ value) { weight[i] = value; }
+
+  const unsigned int* zero_out_nodes(unsigned int step) const { return zero_out.data() + zero_out_offsets[step]; }
+  unsigned int num_zero_out(unsigned int step) const { return zero_out_offsets[step+1] - zero_out_offsets[step]; }
+
+  const unsigned int* sigmoid_nodes(unsigned int step) const { return sigmoid.data() + sigmoid_offsets[step]; }
+  unsigned int num_sigmoid(unsigned int step) const { return sigmoid_offsets[step+1] - sigmoid_offsets[step]; }
+
+  /// Flattened index lists, for copying the plan to other devices
+  const std::vector<unsigned int>& all_zero_out_nodes() const { return zero_out; }
+  const std::vector<unsigned int>& all_sigmoid_nodes() const { return sigmoid; }
+
+  const std::vector<unsigned int>& input_nodes() const { return inputs; }
+  const std::vector<unsigned int>& output_nodes() const { return outputs; }
+  const std::vector<unsigned int>& bias_nodes() const { return biases; }
+
+private:
+  unsigned int n_nodes = 0;
+
+  std::vector<unsigned int> origin;
+  std::vector<unsigned int> dest;
+  std::vector<_float_> weight;
+  std::vector<unsigned int> level_offsets;
+
+  std::vector<unsigned int> zero_out;
+  std::vector<unsigned int> zero_out_offsets;
+  std::vector<unsigned int> sigmoid;
+  std::vector<unsigned int> sigmoid_offsets;
+
+  std::vector<unsigned int> inputs;
+  std::vector<unsigned int> outputs;
+  std::vector<unsigned int> biases;
+};
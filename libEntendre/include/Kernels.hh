@@ -0,0 +1,44 @@
+#pragma once
+#include "NeuralNet.hh"
+
+/// Applies one level of connections to the node values.
+/**
+   For each i<n, adds weight[i]*nodes[origin[i]] to nodes[dest[i]], or
+     scales nodes[dest[i]] by weight[i] if origin[i] == dest[i].
+
+   No two connections in the range may share a destination, as is the
+     case for the connections of one level of an ExecutionPlan.  This
+     lets the vectorized kernels gather, multiply and scatter without
+     conflicts.  The kernel used is selected once, from the
+     instruction sets supported by the running CPU.  The vectorized
+     kernels use a fused multiply-add for every connection, so results
+     may differ from kernel_apply_connections_scalar in the last bit,
+     but do not depend on the position of a connection in the range.
+ */
+void kernel_apply_connections(_float_* nodes,
+                              const unsigned int* origin, const unsigned int* dest,
+                              const _float_* weight, unsigned int n);
+
+/// Portable implementation of kernel_apply_connections.
+void kernel_apply_connections_scalar(_float_* nodes,
+                                     const unsigned int* origin, const unsigned int* dest,
+                                     const _float_* weight, unsigned int n);
+
+/// Applies an activation function to nodes[list[i]], for each i<n.
+/**
+   Uses the same instruction set as kernel_apply_connections.  Each
+     value is computed with the same sequence of operations regardless
+     of its position, so the result does not depend on how the nodes
+     are grouped.  See Activation for the error of each function.
+ */
+void kernel_activate(Activation activation, _float_* nodes,
+                     const unsigned int* list, unsigned int n);
+
+/// Applies an activation function to values[i], for each i<n.
+void kernel_activate(Activation activation, _float_* values, unsigned int n);
+
+/// Applies an activation function to a single value, without vector instructions.
+_float_ kernel_activate(Activation activation, _float_ val);
+
+/// Name of the instruction set used by kernel_apply_connections, for diagnostics.
+const char* kernel_instruction_set();
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <limits>
+#include <vector>
+
+/// Normal connections of a network being built, indexed to find loops.
+/**
+   A new connection from i to j closes a loop of normal connections if i
+     is reachable from j through normal connections.  Each normal
+     connection is kept in a linked list of those leaving its origin, so
+     that the check is a single depth-first search, visiting each
+     reachable node once.
+
+   A connection added as part of a set (a subnet of a composite network)
+     is only checked against the connections added since the set last
+     changed, which all belong to that set.  Each list holds the newest
+     connections first, so the search stops at the first connection
+     added before the current set.
+
+   The search only reads the connections, keeping its working state in
+     a Search.  Networks sharing a detector may thus query it at once,
+     each through its own Search.
+ */
+class LoopDetector {
+public:
+  /// Working state of a search, reused between calls
+  class Search {
+    friend class LoopDetector;
+    // A node has been visited by the current search if its stamp is
+    // current_stamp.
+    std::vector<unsigned int> stamps;
+    unsigned int current_stamp = 0;
+    std::vector<unsigned int> stack;
+  };
+
+  /// Records a connection, in the order added to the network
+  void add_connection(unsigned int origin, unsigned int dest, bool normal,
+                      unsigned int set=std::numeric_limits<unsigned int>::max());
+
+  /// True if a normal connection from origin to dest would close a loop
+  /**
+     If set is the maximum, every normal connection is considered.
+       Otherwise, only the connections added since the set last
+       changed, if they are in the given set.
+   */
+  bool would_make_loop(unsigned int origin, unsigned int dest,
+                       unsigned int set=std::numeric_limits<unsigned int>::max()) {
+    return would_make_loop(origin, dest, set, search);
+  }
+
+  /// As above, keeping the working state in the given search
+  bool would_make_loop(unsigned int origin, unsigned int dest, unsigned int set,
+                       Search& search) const;
+
+private:
+  struct Link {
+    unsigned int dest;
+    // Index of the next link leaving the same origin, or -1.
+    int next;
+  };
+
+  // Index of the newest link leaving each node, or -1.
+  std::vector<int> first_link;
+  std::vector<Link> links;
+
+  // The connections added since the set last changed.
+  bool has_run = false;
+  unsigned int run_set = 0;
+  int run_first_link = 0;
+
+  // Search state of the calls without a search of their own.
+  Search search;
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <limits>
 #include <stdexcept>
 #include <functional>
 #include <cmath>
@@ -22,6 +23,21 @@ struct Node {
   operator _float_() { return value; }
 };
 
+/// Activation function applied to hidden and output nodes.
+/**
+   All are evaluated in single precision without calls to libm, so that
+     they vectorize.  The bounds are the largest absolute error against
+     the exact function in double precision, over all float inputs.
+
+   Logistic:      1/(1+exp(-x)), exp by range reduction and a degree 5
+                    polynomial.  Error below 1e-7.
+   LogisticFast:  0.5 + 0.5*tanh(x/2), tanh by a [7/6] Pade approximant,
+                    saturating for |x| > 9.8.  Error below 5e-5.
+   Tanh:          1 - 2/(1+exp(2x)), using the same exp as Logistic.
+                    Error below 2e-7.
+ */
+enum class Activation { Logistic, LogisticFast, Tanh };
+
 enum class ConnectionType { Normal, Recurrent };
 struct Connection {
   unsigned int origin;
@@ -38,6 +54,35 @@ struct Connection {
       weight(_weight), type(_type), set(_set) {;}
 };
 
+/// Non-owning view of a contiguous array.
+/**
+   Used to pass inputs and outputs to NeuralNet::evaluate without
+     allocating.  Can be made from anything with data() and size(),
+     such as a std::vector, or from a Span of non-const elements.
+ */
+template<typename T>
+class Span {
+public:
+  Span() { ; }
+  Span(T* data, size_t size) : ptr(data), length(size) { ; }
+  template<typename Container>
+  Span(Container& container) : ptr(container.data()), length(container.size()) { ; }
+
+  T* data() const { return ptr; }
+  size_t size() const { return length; }
+  bool empty() const { return length == 0; }
+  T& operator[](size_t i) const { return ptr[i]; }
+  T* begin() const { return ptr; }
+  T* end() const { return ptr + length; }
+
+  /// View of count elements, starting at offset
+  Span subspan(size_t offset, size_t count) const { return Span(ptr + offset, count); }
+
+private:
+  T* ptr = nullptr;
+  size_t length = 0;
+};
+
 class  NeuralNet {
 
 public:
@@ -46,21 +91,78 @@ public:
 
   virtual void add_node(const NodeType& type) = 0;
   virtual void add_connection(int origin, int dest, _float_ weight, unsigned int set=std::numeric_limits<unsigned int>::max()) = 0;
+
+  /// Adds connections whose types are already known.
+  /**
+     Each connection is added as given, rather than finding with
+       add_connection whether it closes a loop.  A normal connection
+       must not close a loop of the normal connections added before it,
+       within the same set if its set is not the maximum.
+   */
+  virtual void add_connections(Span<const Connection> connections) = 0;
+
+  /// Adds a range of connections already sorted on their own.
+  /**
+     connections must be in the order, and with the sets, left by
+       sort_connections on a range holding only them, such as read
+       back with get_connection.  The range is not sorted again, but
+       is merged with the others when the last range is sorted.  Since
+       that range must be sorted, ranges added this way cannot be
+       last.
+   */
+  virtual void add_sorted_connections(Span<const Connection> connections) = 0;
   virtual unsigned int num_nodes() = 0;
   virtual unsigned int num_connections() = 0;
   virtual Connection get_connection(unsigned int i) const = 0;
+
+  /// Position, in the order the connections were added, of connection i
+  virtual unsigned int added_index(unsigned int i) const = 0;
   virtual NodeType get_node_type(unsigned int i) const = 0;
-  virtual std::vector<_float_> evaluate(std::vector<_float_> inputs) = 0;
+  virtual unsigned int num_outputs() const = 0;
+
+  /// Evaluates the network once, without allocating.
+  /**
+     inputs holds one value per input node, and outputs receives one
+       value per output node, so must have num_outputs() elements.
+   */
+  virtual void evaluate(Span<const _float_> inputs, Span<_float_> outputs) = 0;
+
+  /// Evaluates the network once, returning a new vector of outputs.
+  std::vector<_float_> evaluate(const std::vector<_float_>& inputs);
+
+  /// Prepares the connections for evaluation, called before the first evaluate
+  /**
+     May be called on consecutive ranges of connections, such as the
+       sets of a composite network, in which case the range ending at
+       the last connection must be sorted last.  The other ranges only
+       touch their own connections, so may be sorted concurrently.
+   */
   virtual void sort_connections(unsigned int first=0, unsigned int num_connections=0) = 0;
+
+  /// Overwrites the weight of every connection, sorted or not
+  /**
+     weights holds one value per connection, in the order the
+       connections were added.  The connections are not sorted again,
+       so a copy of a sorted network can be given new weights cheaply.
+   */
+  virtual void set_weights(Span<const _float_> weights) = 0;
+
+  /// Returns every node to its value in a newly built network
+  virtual void reset_state() = 0;
   virtual std::unique_ptr<NeuralNet> clone() const = 0;
 
   virtual void print_network(std::ostream& os) const = 0;
   void register_sigmoid(std::function<_float_(_float_)> sig) {sigma = sig;}
 
+  /// Selects the built-in activation, used unless a sigmoid is registered.
+  void set_activation(Activation act) { activation = act; }
+  Activation get_activation() const { return activation; }
+
 protected:
   _float_ sigmoid(_float_ val) const;
-  bool connections_sorted;
+  bool connections_sorted = false;
   std::function<_float_(_float_ val)> sigma;
+  Activation activation = Activation::Logistic;
 
 private:
 
@@ -1,17 +1,34 @@
 #pragma once
 #include "NeuralNet.hh"
+#include "Activations.hh"
+#include "Kernels.hh"
+#include "LoopDetector.hh"
 
+#include <atomic>
 #include <vector>
 #include <stdexcept>
 #include <functional>
 #include <cmath>
 #include <cassert>
 #include <memory>
-#include <map>
 
 
 
-template<typename T>
+/// Shared implementation of the CPU networks.
+/**
+   T is the derived network.  ActivationPolicy is the activation applied
+     to hidden and output nodes, as one of the functors of
+     Activations.hh or any other functor with the same signature.  A
+     sigmoid given to register_sigmoid still takes precedence, at the
+     cost of a call through std::function per node.
+
+   Networks are copied far more often than their connections change,
+     such as with the organisms holding them, so copies share one
+     table of connections, and one loop detector.  A network copies
+     them before its first change to them, if any other network shares
+     them.  A copy thus only holds its own node values.
+ */
+template<typename T, typename ActivationPolicy=RuntimeActivation>
 class NeuralNet_CRTP : public NeuralNet {
 public:
   virtual ~NeuralNet_CRTP() { ; }
@@ -21,140 +38,157 @@ public:
 
 
   virtual void add_connection(int origin, int dest, _float_ weight, unsigned int set=std::numeric_limits<unsigned int>::max());
+  virtual void add_connections(Span<const Connection> connections);
+  virtual void add_sorted_connections(Span<const Connection> connections);
+  virtual unsigned int added_index(unsigned int i) const { return table().added_order[i]; }
   virtual unsigned int num_nodes() { return static_cast<T*>(this)->nodes.size(); }
-  virtual unsigned int num_connections() { return static_cast<T*>(this)->connections.size(); }
-  auto& get_connections() { return static_cast<T*>(this)->connections; }
+  virtual unsigned int num_connections() { return table().connections.size(); }
+  const std::vector<Connection>& get_connections() const { return table().connections; }
 
   virtual void print_network(std::ostream& os) const { std::string str = "Needs Impl."; os << str; }
 
 protected:
+  struct ConnectionTable {
+    std::vector<Connection> connections;
+    // The position, in the order added, of each connection.  Sorting
+    // permutes it along with the connections.
+    std::vector<unsigned int> added_order;
+  };
+
+  const ConnectionTable& table() const { return *shared_table; }
+
+  /// The table, copied first if any other network shares it
+  /**
+     Ranges of a network may be sorted concurrently only if its table
+       is not shared, as for a network still being built.
+   */
+  ConnectionTable& mutable_table() { return unshare(shared_table); }
+
+  /// The object held by ptr, copied first if any other network shares it
+  template<typename Shared>
+  static Shared& unshare(std::shared_ptr<Shared>& ptr) {
+    if(ptr.use_count() > 1) {
+      ptr = std::make_shared<Shared>(*ptr);
+    } else {
+      // Networks that shared the object may have released it on
+      // another thread.  Their reads of it must happen before our writes.
+      std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *ptr;
+  }
+
   bool would_make_loop(unsigned int i, unsigned int j, unsigned int set=std::numeric_limits<unsigned int>::max());
 
+  /// Value of a node, given the sum of its inputs
+  _float_ activate(_float_ val) const {
+    return sigma ? sigma(val) : apply_activation(ActivationPolicy(), val);
+  }
+
+  /// Applies the activation to nodes[list[i]], for each i<n
+  void activate_nodes(_float_* nodes, const unsigned int* list, unsigned int n) const {
+    if(sigma) {
+      for(auto i=0u; i<n; i++) {
+        nodes[list[i]] = sigma(nodes[list[i]]);
+      }
+    } else {
+      apply_activation(ActivationPolicy(), nodes, list, n);
+    }
+  }
+
+  /// Applies the activation to values[i], for each i<n
+  void activate_values(_float_* values, unsigned int n) const {
+    if(sigma) {
+      for(auto i=0u; i<n; i++) {
+        values[i] = sigma(values[i]);
+      }
+    } else {
+      apply_activation(ActivationPolicy(), values, n);
+    }
+  }
+
 private:
+  std::shared_ptr<ConnectionTable> shared_table = std::make_shared<ConnectionTable>();
+  std::shared_ptr<LoopDetector> loop_detector = std::make_shared<LoopDetector>();
+  // Each copy searches the shared detector with its own state.
+  LoopDetector::Search loop_search;
+
+  // The runtime policy goes through the dispatched kernels, any other
+  // policy is inlined into the loop.
+  _float_ apply_activation(RuntimeActivation, _float_ val) const {
+    return kernel_activate(activation, val);
+  }
+  void apply_activation(RuntimeActivation, _float_* nodes, const unsigned int* list, unsigned int n) const {
+    kernel_activate(activation, nodes, list, n);
+  }
+  void apply_activation(RuntimeActivation, _float_* values, unsigned int n) const {
+    kernel_activate(activation, values, n);
+  }
 
+  template<typename Policy>
+  static _float_ apply_activation(Policy policy, _float_ val) {
+    return policy(val);
+  }
+  template<typename Policy>
+  static void apply_activation(Policy policy, _float_* nodes, const unsigned int* list, unsigned int n) {
+    for(auto i=0u; i<n; i++) {
+      nodes[list[i]] = policy(nodes[list[i]]);
+    }
+  }
+  template<typename Policy>
+  static void apply_activation(Policy policy, _float_* values, unsigned int n) {
+    for(auto i=0u; i<n; i++) {
+      values[i] = policy(values[i]);
+    }
+  }
 };
 
 
 
 #include <iostream>
 
-template <typename T>
-void NeuralNet_CRTP<T>::add_connection(int origin, int dest, _float_ weight, unsigned int set) {
+template <typename T, typename ActivationPolicy>
+void NeuralNet_CRTP<T, ActivationPolicy>::add_connection(int origin, int dest, _float_ weight, unsigned int set) {
+  auto& own = mutable_table();
+  own.added_order.push_back(own.added_order.size());
   if(would_make_loop(origin,dest,set)) {
-    static_cast<T*>(this)->connections.emplace_back(origin,dest,ConnectionType::Recurrent,weight,set);
+    own.connections.emplace_back(origin,dest,ConnectionType::Recurrent,weight,set);
+    unshare(loop_detector).add_connection(origin,dest,false,set);
   } else {
-    static_cast<T*>(this)->connections.emplace_back(origin,dest,ConnectionType::Normal,weight,set);
+    own.connections.emplace_back(origin,dest,ConnectionType::Normal,weight,set);
+    unshare(loop_detector).add_connection(origin,dest,true,set);
   }
 }
 
-// TODO: This function needs some refactoring. Currently there is code repetition due to the fact that the
-//       map required for the subnet sorting (which is only needed for composite nets) is very slow when
-//       applied to an entire population. Thus, for now there are two different functionalities depending
-//       on whether or not a finite set value is used
-template <typename T>
-bool NeuralNet_CRTP<T>::would_make_loop(unsigned int i, unsigned int j, unsigned int set) {
-  // handle the case of a recurrent connection to itself up front
-  if (i == j) { return true; }
-
-  if (set == std::numeric_limits<unsigned int>::max()) {
-
-    std::vector<bool> reachable(static_cast<T*>(this)->nodes.size(), false);
-    reachable[j] = true;
-
-    while (true) {
-
-      bool found_new_node = false;
-      for (auto const& conn : static_cast<T*>(this)->connections) {
-        // if the origin of this connection is reachable and its
-        // desitination is not, then it should be made reachable
-        if (reachable[conn.origin] &&
-                    !reachable[conn.dest] &&
-            conn.type == ConnectionType::Normal) {
-          // if it is a normal node. if it is the origin of the
-          // proposed additional connection (i->j) then it would be
-          // a loop
-          if (conn.dest == i) {
-            // the destination of this reachable connection is
-            // the origin of the proposed connection. thus there
-            // exists a path from j -> i. So this will be a loop.
-            return true;
-          }
-          else {
-            reachable[conn.dest] = true;
-            found_new_node = true;
-          }
-        }
-      }
-      // no loop detected
-      if (!found_new_node) {
-        return false;
-      }
-
-    }
-
-  } else {
-    // if set number is not zero, then it is assumed the added connection is
-    // part of a subnet that is currently being added.
-
-    std::map<unsigned int,unsigned int> subset_node_map;
-    subset_node_map[i] = subset_node_map.size();
-    subset_node_map[j] = subset_node_map.size();
-
-    auto conn_iter = static_cast<T*>(this)->connections.end();
-    while (conn_iter-- != static_cast<T*>(this)->connections.begin()) {
-      auto conn_set = (*conn_iter).set;
-      if (conn_set != set){
-        break;
-      } else {
-        auto origin = (*conn_iter).origin;
-        auto dest = (*conn_iter).dest;
-
-        if (subset_node_map.count(origin)==0) {
-          subset_node_map[origin] = subset_node_map.size();
-        }
-        if (subset_node_map.count(dest)==0) {
-          subset_node_map[dest] = subset_node_map.size();
-        }
-      }
-
-    }
-
-
-    std::vector<bool> reachable(subset_node_map.size(), false);
-    reachable[subset_node_map[j]] = true;
-    while (true) {
-      auto conn_start = conn_iter;
-
-      bool found_new_node = false;
-      while (++conn_start != static_cast<T*>(this)->connections.end()) {
-        auto const& conn = *conn_start;
-        assert(conn.set == set);
-
-        // if the origin of this connection is reachable and its
-        // desitination is not, then it should be made reachable
-        if (reachable[subset_node_map[conn.origin]] &&
-            !reachable[subset_node_map[conn.dest]] &&
-            conn.type == ConnectionType::Normal) {
-          // if it is a normal node. if it is the origin of the
-          // proposed additional connection (i->j) then it would be
-          // a loop
-          if (conn.dest == i) {
-            // the destination of this reachable connection is
-            // the origin of the proposed connection. thus there
-            // exists a path from j -> i. So this will be a loop.
-            return true;
-          }
-          else {
-            reachable[subset_node_map[conn.dest]] = true;
-            found_new_node = true;
-          }
-        }
-      }
-      // no loop detected
-      if (!found_new_node) {
-        return false;
-      }
+template <typename T, typename ActivationPolicy>
+void NeuralNet_CRTP<T, ActivationPolicy>::add_connections(Span<const Connection> connections) {
+  auto& own = mutable_table();
+  auto& detector = unshare(loop_detector);
+  own.connections.reserve(own.connections.size() + connections.size());
+  for(auto& conn : connections) {
+    bool normal = conn.type == ConnectionType::Normal;
+    assert(!normal || !would_make_loop(conn.origin,conn.dest,conn.set));
+    own.connections.push_back(conn);
+    own.added_order.push_back(own.added_order.size());
+    detector.add_connection(conn.origin,conn.dest,normal,conn.set);
+  }
+}
 
-    }
+template <typename T, typename ActivationPolicy>
+void NeuralNet_CRTP<T, ActivationPolicy>::add_sorted_connections(Span<const Connection> connections) {
+  auto& own = mutable_table();
+  auto& detector = unshare(loop_detector);
+  own.connections.reserve(own.connections.size() + connections.size());
+  for(auto& conn : connections) {
+    own.connections.push_back(conn);
+    own.added_order.push_back(own.added_order.size());
+    // The set of a sorted connection may no longer be the one it was
+    // added with, so it is only considered for loops across all sets.
+    detector.add_connection(conn.origin,conn.dest,conn.type == ConnectionType::Normal);
   }
 }
+
+template <typename T, typename ActivationPolicy>
+bool NeuralNet_CRTP<T, ActivationPolicy>::would_make_loop(unsigned int i, unsigned int j, unsigned int set) {
+  // Only the search state changes, so a shared detector stays shared.
+  return loop_detector->would_make_loop(i,j,set,loop_search);
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "NeuralNet.hh"
+#include "ExecutionPlan.hh"
+
+#include <vector>
+
+/// Many independent networks, evaluated together through one flat plan.
+/**
+   Each network added gets its own range of a shared node array, and its
+     connections are scheduled into levels as in ConcurrentNeuralNet.
+     Level i of the batch is then level i of every network.  The
+     networks share no nodes, so each merged level is still free of
+     conflicts.  Each step therefore applies the activation and the
+     connections of all networks at once, through the vectorized kernels
+     of Kernels.hh.
+
+   Inputs and outputs are the concatenation of the inputs and outputs of
+     each network, in the order the networks were added.  input_offset()
+     and output_offset() give where each network's values begin.
+
+   Every network is evaluated on each call, unless only some are marked
+     active.  The state of recurrent nodes is kept between calls,
+     separately from the networks the batch was built from.  All
+     networks use the same activation, chosen with set_activation.
+     Sigmoids registered on the original networks are not used.
+ */
+class PopulationBatchNet {
+public:
+  /// Adds a copy of the structure and weights of a network, returning its index
+  /**
+     Adding a network after evaluating resets the state of every network.
+   */
+  unsigned int add_network(NeuralNet& net);
+
+  unsigned int num_networks() const { return input_offsets.size()-1; }
+  unsigned int num_nodes() const { return node_types.size(); }
+  unsigned int num_connections() const { return connections.size(); }
+
+  unsigned int num_inputs() const { return input_offsets.back(); }
+  unsigned int num_outputs() const { return output_offsets.back(); }
+
+  /// Index of the first input of a network, within the inputs passed to evaluate
+  unsigned int input_offset(unsigned int net) const { return input_offsets[net]; }
+  unsigned int num_inputs(unsigned int net) const { return input_offsets[net+1] - input_offsets[net]; }
+
+  /// Index of the first output of a network, within the outputs written by evaluate
+  unsigned int output_offset(unsigned int net) const { return output_offsets[net]; }
+  unsigned int num_outputs(unsigned int net) const { return output_offsets[net+1] - output_offsets[net]; }
+
+  void set_activation(Activation act) { activation = act; }
+
+  /// Evaluates every network once.
+  /**
+     inputs must have num_inputs() elements, and outputs num_outputs().
+   */
+  void evaluate(Span<const _float_> inputs, Span<_float_> outputs);
+
+  /// Evaluates the networks marked active, leaving the others as they were
+  /**
+     active must have num_networks() elements.  The nodes of inactive
+       networks are restored after the step, so their state is as if
+       they had not been evaluated, and their outputs are those of their
+       last evaluation.
+   */
+  void evaluate(Span<const _float_> inputs, Span<_float_> outputs,
+                const std::vector<bool>& active);
+
+private:
+  void build_plan();
+  void propagate(Span<const _float_> inputs);
+  void read_outputs(Span<_float_> outputs) const;
+
+  std::vector<NodeType> node_types;
+  std::vector<Connection> connections;
+  std::vector<unsigned int> node_offsets = {0};
+  std::vector<unsigned int> input_offsets = {0};
+  std::vector<unsigned int> output_offsets = {0};
+  Activation activation = Activation::Logistic;
+
+  bool plan_built = false;
+  ExecutionPlan plan;
+  std::vector<_float_> nodes;
+  // Nodes of the inactive networks, kept during a step
+  std::vector<_float_> saved_nodes;
+};
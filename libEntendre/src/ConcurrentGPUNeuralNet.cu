@@ -4,12 +4,13 @@
 #include <stdexcept>
 #include <cmath>
 #include <iostream>
-#include <map>
 #include <set>
 #include <sstream>
 #include <vector>
 #include <algorithm>
 
+#include "ConnectionScheduler.hh"
+#include "ExecutionPlan.hh"
 #include "logging.h"
 #include "math.h"
 
@@ -30,40 +31,8 @@ ConcurrentGPUNeuralNet::~ConcurrentGPUNeuralNet() {
   if (origin_) { cuda_assert(cudaFree(origin_)); }
   if (dest_) { cuda_assert(cudaFree(dest_)); }
   if (weight_) { cuda_assert(cudaFree(weight_)); }
-  if (action_list_) { cuda_assert(cudaFree(action_list_)); }
-}
-
-ConcurrentGPUNeuralNet::EvaluationOrder ConcurrentGPUNeuralNet::compare_connections(const Connection& a, const Connection& b) {
-    // A recurrent connection must be used before the origin is overwritten.
-  if (a.type == ConnectionType::Recurrent && a.origin == b.dest) { return EvaluationOrder::LessThan; }
-  if (b.type == ConnectionType::Recurrent && b.origin == a.dest) { return EvaluationOrder::GreaterThan; }
-
-  // A normal connection must occur after every connection incoming to its origin has completed.
-  if (a.type == ConnectionType::Normal && a.dest == b.origin) { return EvaluationOrder::LessThan; }
-  if (b.type == ConnectionType::Normal && b.dest == a.origin) { return EvaluationOrder::GreaterThan; }
-
-  // Two connections writing to the same destination must be in different sets.
-  if (a.dest == b.dest) {
-    // A self-recurrent connection happens at the same time as
-    // zero-ing out, and so must occur first of all connections
-    // writing to that node.
-    if(a.origin == a.dest) {
-      return EvaluationOrder::LessThan;
-    } else if (b.origin == b.dest) {
-      return EvaluationOrder::GreaterThan;
-    } else {
-      // Choice here is absolutely arbitrary.
-      // This is arbitrary, and consistent.
-      if(a.origin < b.origin) {
-        return EvaluationOrder::GreaterThan;
-      } else {
-        return EvaluationOrder::LessThan;
-      }
-    }
-  }
-
-  // else a & b are not adjacent and cannot be compared
-  return EvaluationOrder::Unknown;
+  if (zero_out_) { cuda_assert(cudaFree(zero_out_)); }
+  if (sigmoid_) { cuda_assert(cudaFree(sigmoid_)); }
 }
 
 void ConcurrentGPUNeuralNet::sort_connections(unsigned int first, unsigned int num_connections) {
@@ -81,57 +50,7 @@ void ConcurrentGPUNeuralNet::sort_connections(unsigned int first, unsigned int n
   // larger than the total number of connections
   assert(first+num_connections <= connections.size());
 
-  // zero out connection set index for use in sorting
-  for (auto i=first; i<first+num_connections; i++) {
-    connections[i].set = 0;
-  }
-  for(auto i=first; i<first+num_connections; i++) {
-    for(auto j=i+1; j<first+num_connections; j++) {
-      Connection& conn1 = connections[i];
-      Connection& conn2 = connections[j];
-      switch(compare_connections(conn1,conn2)) {
-        case EvaluationOrder::GreaterThan:
-          conn1.set++;
-          break;
-
-        case EvaluationOrder::LessThan:
-          conn2.set++;
-          break;
-
-        case EvaluationOrder::Unknown:
-          break;
-      }
-    }
-  }
-
-  auto split_iter = connections.begin()+first;
-  auto last_iter = connections.begin()+first+num_connections;
-  size_t current_set_num = 0;
-  while(split_iter != last_iter) {
-    auto next_split = std::partition(split_iter, last_iter,
-                                     [](const Connection& conn) {
-                                       return conn.set == 0;
-                                     });
-    assert(next_split != split_iter);
-
-    // These could be run now, no longer need to track number of
-    // depencencies.
-    for(auto iter = split_iter; iter<next_split; iter++) {
-      iter->set = current_set_num;
-    }
-    current_set_num++;
-
-    // Decrease number of dependencies for everything else.
-    for(auto iter_done = split_iter; iter_done<next_split; iter_done++) {
-      for(auto iter_not_done = next_split; iter_not_done<last_iter; iter_not_done++) {
-        if (compare_connections(*iter_done,*iter_not_done) == EvaluationOrder::LessThan) {
-          iter_not_done->set--;
-        }
-      }
-    }
-
-    split_iter = next_split;
-  }
+  schedule_connection_sets(connections.data()+first, num_connections, added_order.data()+first);
 
   // build the action list if num_connections was the total set
   // or if this is the last subset of connections (all others are sorted)
@@ -142,161 +61,66 @@ void ConcurrentGPUNeuralNet::sort_connections(unsigned int first, unsigned int n
 
     if (first != 0) {
       // sort connections based on evaluation set number if not already done
-      std::sort(connections.begin(),connections.end(),[](Connection a, Connection b){ return a.set < b.set; });
-    }
-    // build struct of arrays for use on GPU
-    for (auto i=0u; i<connections.size(); i++) {
-      auto& conn = connections[i];
-      connection_list.add(conn.origin,conn.dest,conn.weight);
+      sort_by_set(connections.data(), connections.size(), added_order.data());
     }
-    build_action_list();
+    plan = ExecutionPlan(node_types, connections);
     connections_sorted = true;
-    connections.clear();
     synchronize();
   }
 }
 
-void ConcurrentGPUNeuralNet::ConcurrentGPUNeuralNet::build_action_list() {
-
-  unsigned int num_connection_sets = connections.back().set+1;
-  std::vector<unsigned int> connection_set_sizes(num_connection_sets, 0);
-  for(auto& conn : connections) {
-    connection_set_sizes[conn.set]++;
-  }
-
-  std::vector<unsigned int> earliest_zero_out_indices(nodes.size(), 0);
-  std::vector<unsigned int> earliest_sigmoid_indices(nodes.size(), 0);
-
-  std::vector<unsigned int> latest_zero_out_indices(nodes.size(), num_connection_sets);
-  std::vector<unsigned int> latest_sigmoid_indices(nodes.size(), num_connection_sets);
-
-  std::set<unsigned int> self_recurrent_nodes;
-
-  for(auto& conn : connections) {
-    // delay earliest possible zeroing of recurrent connections origins
-    // until recurrent connections are applied
-    if(conn.type == ConnectionType::Recurrent) {
-      earliest_zero_out_indices[conn.origin] = std::max(
-        earliest_zero_out_indices[conn.origin],
-        conn.set + 1);
-    }
-
-    earliest_sigmoid_indices[conn.dest] = std::max(
-      earliest_sigmoid_indices[conn.dest],
-      conn.set + 1);
-
-    latest_zero_out_indices[conn.dest] = std::min(
-      latest_zero_out_indices[conn.dest],
-      conn.set);
-
-    if(conn.type == ConnectionType::Normal) {
-      latest_sigmoid_indices[conn.origin] = std::min(
-        latest_sigmoid_indices[conn.origin],
-        conn.set);
-    }
-
-    if(conn.origin == conn.dest) {
-      self_recurrent_nodes.insert(conn.origin);
+void ConcurrentGPUNeuralNet::set_weights(Span<const _float_> weights) {
+  assert(weights.size() == connections.size());
+  for(auto i=0u; i<connections.size(); i++) {
+    connections[i].weight = weights[added_order[i]];
+    // the plan holds the connections in the same order
+    if(connections_sorted) {
+      plan.set_weight(i, connections[i].weight);
     }
   }
-
-  std::vector<unsigned int>& zero_out_indices = earliest_zero_out_indices;
-  std::vector<unsigned int>& sigmoid_indices = earliest_sigmoid_indices;
-
-
-  std::vector<std::vector<unsigned int> > zero_out_sets(num_connection_sets+1);
-  std::vector<std::vector<unsigned int> > sigmoid_sets(num_connection_sets+1);
-
-  for(unsigned int i=0; i<nodes.size(); i++) {
-    bool is_self_recurrent = self_recurrent_nodes.count(i);
-    if(!is_self_recurrent && i >= num_inputs) {
-      zero_out_sets[zero_out_indices[i]].push_back(i);
-    }
-    if(i >= num_inputs) {
-      sigmoid_sets[sigmoid_indices[i]].push_back(i);
-    }
+  if(weight_) {
+    cuda_assert(cudaMemcpy(weight_,plan.weights(),plan.num_connections()*sizeof(_float_),cudaMemcpyHostToDevice));
   }
+}
 
-  auto append_zero_out_set = [&](unsigned int i) {
-    auto& zero_out_set = zero_out_sets[i];
-    action_list.push_back(zero_out_set.size());
-    for(unsigned int j : zero_out_set) {
-      action_list.push_back(j);
-    }
-  };
-
-  auto append_sigmoid_set = [&](unsigned int i) {
-    auto& sigmoid_set = sigmoid_sets[i];
-    action_list.push_back(sigmoid_set.size());
-    for(unsigned int j : sigmoid_set) {
-      action_list.push_back(j);
-    }
-  };
-
-
-
-  action_list.clear();
-  for(unsigned int i=0; i<num_connection_sets; i++) {
-    append_zero_out_set(i);
-    append_sigmoid_set(i);
-    action_list.push_back(connection_set_sizes[i]);
+void ConcurrentGPUNeuralNet::reset_state() {
+  for(auto i=0u; i<nodes.size(); i++) {
+    nodes[i] = node_types[i] == NodeType::Bias ? 1.0 : 0.0;
+  }
+  if(node_) {
+    cuda_assert(cudaMemcpy(node_,nodes.data(),nodes.size()*sizeof(_float_),cudaMemcpyHostToDevice));
   }
-
-  append_zero_out_set(num_connection_sets);
-  append_sigmoid_set(num_connection_sets);
-
-
-
-  // print action list
-  // for (auto& item : action_list) {
-  //   std::cout << item << " ";
-  // } std::cout << std::endl;
 }
 
-
 ////////////////////////////////////////////////////////////////////////////
 
 void ConcurrentGPUNeuralNet::add_node(const NodeType& type) {
-switch (type) {
-  case NodeType::Bias:
-    num_inputs++;
-    nodes.push_back(1.0);
-    break;
-  case NodeType::Input:
-    num_inputs++;
-    nodes.push_back(0.0);
-    break;
-  case NodeType::Output:
-    num_outputs++;
-    nodes.push_back(0.0);
-    break;
-  case NodeType::Hidden:
-    nodes.push_back(0.0);
-    break;
-  };
+  node_types.push_back(type);
+  n_outputs += IsOutput(type);
+  nodes.push_back(type == NodeType::Bias ? 1.0 : 0.0);
 }
 
 _float_ sigmoid(_float_ val) {
   return 1/(1 + std::exp(-val));
 }
 
-void clear_nodes(unsigned int* list, _float_* nodes, unsigned int n) {
+void clear_nodes(const unsigned int* list, _float_* nodes, unsigned int n) {
   for(auto i=0u; i<n; i++) {
     nodes[list[i]] = 0;
   }
 }
 
-void sigmoid_nodes(unsigned int* list, _float_* nodes, unsigned int n) {
+void sigmoid_nodes(const unsigned int* list, _float_* nodes, unsigned int n) {
   for(auto i=0u; i<n; i++) {
     nodes[list[i]] = sigmoid(nodes[list[i]]);
   }
 }
 
-void apply_connections(_float_* node, unsigned int* origin, unsigned int* dest, _float_* weight, unsigned int n) {
+void apply_connections(_float_* node, const unsigned int* origin, const unsigned int* dest, const _float_* weight, unsigned int n) {
   for(auto i=0u; i<n; i++) {
-    auto& conn_origin = origin[i];
-    auto& conn_dest = dest[i];
-    auto& conn_weight = weight[i];
+    auto conn_origin = origin[i];
+    auto conn_dest = dest[i];
+    auto conn_weight = weight[i];
     if(conn_origin == conn_dest) {
       // Special case for self-recurrent nodes
       // Be sure not to zero-out before this step.
@@ -342,214 +166,128 @@ __global__ void device_apply_connections(_float_* node, unsigned int* origin, un
 }
 
 std::vector<_float_> ConcurrentGPUNeuralNet::host_evaluate(std::vector<_float_> inputs) {
-  assert(inputs.size() == num_inputs-1);
   sort_connections();
+  auto& input_nodes = plan.input_nodes();
+  assert(inputs.size() == input_nodes.size());
 
   // copy inputs in to network
-  std::copy(inputs.begin(),inputs.end(),nodes.begin()+1);
-
-  auto i = 0u;
-  int how_many_zero_out = action_list[i++];
-  clear_nodes(&action_list[i], nodes.data(), how_many_zero_out);
-  i += how_many_zero_out;
-
-  int how_many_sigmoid = action_list[i++];
-  sigmoid_nodes(&action_list[i], nodes.data(), how_many_sigmoid);
-  i += how_many_sigmoid;
-
-  int current_conn = 0;
-  while(i<action_list.size()) {
-    int how_many_conn = action_list[i++];
-    apply_connections(nodes.data(), &connection_list.origin[current_conn], &connection_list.dest[current_conn], &connection_list.weight[current_conn], how_many_conn);
-    current_conn += how_many_conn;
-
-    int how_many_zero_out = action_list[i++];
-    clear_nodes(&action_list[i], nodes.data(), how_many_zero_out);
-    i += how_many_zero_out;
-
-    int how_many_sigmoid = action_list[i++];
-    sigmoid_nodes(&action_list[i], nodes.data(), how_many_sigmoid);
-    i += how_many_sigmoid;
+  for(auto k=0u; k<input_nodes.size(); k++) {
+    nodes[input_nodes[k]] = inputs[k];
   }
 
-  return std::vector<_float_> (nodes.begin()+num_inputs,nodes.begin()+num_inputs+num_outputs);
+  for(auto step=0u; step<=plan.num_levels(); step++) {
+    clear_nodes(plan.zero_out_nodes(step), nodes.data(), plan.num_zero_out(step));
+    sigmoid_nodes(plan.sigmoid_nodes(step), nodes.data(), plan.num_sigmoid(step));
+    if(step < plan.num_levels()) {
+      auto first = plan.level_begin(step);
+      apply_connections(nodes.data(), plan.origins()+first, plan.dests()+first, plan.weights()+first, plan.level_size(step));
+    }
+  }
+
+  auto& output_nodes = plan.output_nodes();
+  std::vector<_float_> outputs(output_nodes.size());
+  for(auto k=0u; k<output_nodes.size(); k++) {
+    outputs[k] = nodes[output_nodes[k]];
+  }
+  return outputs;
 }
 
-std::vector<_float_> ConcurrentGPUNeuralNet::evaluate(std::vector<_float_> inputs) {
-  assert(inputs.size() == num_inputs-1);
+void ConcurrentGPUNeuralNet::evaluate(Span<const _float_> inputs, Span<_float_> outputs) {
   sort_connections();
+  auto& input_nodes = plan.input_nodes();
+  assert(inputs.size() == input_nodes.size());
   unsigned int num_blocks = 0;
 
-  // copy inputs in to network
-  //std::copy(inputs.begin(),inputs.end(),nodes.begin());
-  cuda_assert(cudaMemcpy(&node_[1],inputs.data(),inputs.size()*sizeof(_float_),cudaMemcpyHostToDevice));
-
-  auto i = 0u;
-  int how_many_zero_out = action_list[i++];
-  num_blocks = (how_many_zero_out+num_threads-1)/num_threads;
-  if (how_many_zero_out) { device_clear_nodes<<<num_blocks,num_threads>>>(&action_list_[i], node_, how_many_zero_out); }
-  i += how_many_zero_out;
-
-  int how_many_sigmoid = action_list[i++];
-  num_blocks = (how_many_sigmoid+num_threads-1)/num_threads;
-  if (how_many_sigmoid) { device_sigmoid_nodes<<<num_blocks,num_threads>>>(&action_list_[i], node_, how_many_sigmoid); }
-  i += how_many_sigmoid;
-
-  int current_conn = 0;
-  while(i<action_list.size()) {
-    int how_many_conn = action_list[i++];
-    num_blocks = (how_many_conn+num_threads-1)/num_threads;
-    if (how_many_conn) { device_apply_connections<<<num_blocks,num_threads>>>(node_, &origin_[current_conn], &dest_[current_conn], &weight_[current_conn], how_many_conn); }
-    current_conn += how_many_conn;
-
-    int how_many_zero_out = action_list[i++];
+  // copy inputs in to network, input nodes are contiguous
+  assert(input_nodes.back() - input_nodes.front() + 1 == input_nodes.size());
+  cuda_assert(cudaMemcpy(&node_[input_nodes.front()],inputs.data(),inputs.size()*sizeof(_float_),cudaMemcpyHostToDevice));
+
+  unsigned int zero_out_first = 0;
+  unsigned int sigmoid_first = 0;
+  for(auto step=0u; step<=plan.num_levels(); step++) {
+    unsigned int how_many_zero_out = plan.num_zero_out(step);
     num_blocks = (how_many_zero_out+num_threads-1)/num_threads;
-    if (how_many_zero_out) { device_clear_nodes<<<num_blocks,num_threads>>>(&action_list_[i], node_, how_many_zero_out); }
-    i += how_many_zero_out;
+    if (how_many_zero_out) { device_clear_nodes<<<num_blocks,num_threads>>>(&zero_out_[zero_out_first], node_, how_many_zero_out); }
+    zero_out_first += how_many_zero_out;
 
-    int how_many_sigmoid = action_list[i++];
+    unsigned int how_many_sigmoid = plan.num_sigmoid(step);
     num_blocks = (how_many_sigmoid+num_threads-1)/num_threads;
-    if (how_many_sigmoid) { device_sigmoid_nodes<<<num_blocks,num_threads>>>(&action_list_[i], node_, how_many_sigmoid); }
-    i += how_many_sigmoid;
+    if (how_many_sigmoid) { device_sigmoid_nodes<<<num_blocks,num_threads>>>(&sigmoid_[sigmoid_first], node_, how_many_sigmoid); }
+    sigmoid_first += how_many_sigmoid;
+
+    if (step < plan.num_levels()) {
+      unsigned int first = plan.level_begin(step);
+      unsigned int how_many_conn = plan.level_size(step);
+      num_blocks = (how_many_conn+num_threads-1)/num_threads;
+      if (how_many_conn) { device_apply_connections<<<num_blocks,num_threads>>>(node_, &origin_[first], &dest_[first], &weight_[first], how_many_conn); }
+    }
   }
   cuda_assert(cudaDeviceSynchronize());
-  std::vector<_float_> outputs(num_outputs,0);
-  cuda_assert(cudaMemcpy(outputs.data(),&node_[num_inputs],num_outputs*sizeof(_float_),cudaMemcpyDeviceToHost));
 
-  return outputs;
+  // output nodes are contiguous
+  auto& output_nodes = plan.output_nodes();
+  assert(output_nodes.back() - output_nodes.front() + 1 == output_nodes.size());
+  assert(outputs.size() == output_nodes.size());
+  cuda_assert(cudaMemcpy(outputs.data(),&node_[output_nodes.front()],outputs.size()*sizeof(_float_),cudaMemcpyDeviceToHost));
 }
 
 void ConcurrentGPUNeuralNet::add_connection(int origin, int dest, _float_ weight, unsigned int set) {
+  added_order.push_back(added_order.size());
   if(would_make_loop(origin,dest,set)) {
     connections.emplace_back(origin,dest,ConnectionType::Recurrent,weight,set);
+    loop_detector.add_connection(origin,dest,false,set);
   } else {
     connections.emplace_back(origin,dest,ConnectionType::Normal,weight,set);
+    loop_detector.add_connection(origin,dest,true,set);
   }
 }
 
-bool ConcurrentGPUNeuralNet::would_make_loop(unsigned int i, unsigned int j, unsigned int set) {
-  // handle the case of a recurrent connection to itself up front
-  if (i == j) { return true; }
-
-  if (set == std::numeric_limits<unsigned int>::max()) {
-
-    std::vector<bool> reachable(nodes.size(), false);
-    reachable[j] = true;
-
-    while (true) {
-
-      bool found_new_node = false;
-      for (auto const& conn : connections) {
-        // if the origin of this connection is reachable and its
-        // desitination is not, then it should be made reachable
-        if (reachable[conn.origin] &&
-                    !reachable[conn.dest] &&
-            conn.type == ConnectionType::Normal) {
-          // if it is a normal node. if it is the origin of the
-          // proposed additional connection (i->j) then it would be
-          // a loop
-          if (conn.dest == i) {
-            // the destination of this reachable connection is
-            // the origin of the proposed connection. thus there
-            // exists a path from j -> i. So this will be a loop.
-            return true;
-          }
-          else {
-            reachable[conn.dest] = true;
-            found_new_node = true;
-          }
-        }
-      }
-      // no loop detected
-      if (!found_new_node) {
-        return false;
-      }
-
-    }
-
-  } else {
-    // if set number is not zero, then it is assumed the added connection is
-    // part of a subnet that is currently being added.
-
-    std::map<unsigned int,unsigned int> subset_node_map;
-    subset_node_map[i] = subset_node_map.size();
-    subset_node_map[j] = subset_node_map.size();
-
-    auto conn_iter = connections.end();
-    while (conn_iter-- != connections.begin()) {
-      auto conn_set = (*conn_iter).set;
-      if (conn_set != set){
-        break;
-      } else {
-        auto origin = (*conn_iter).origin;
-        auto dest = (*conn_iter).dest;
-
-        if (subset_node_map.count(origin)==0) {
-          subset_node_map[origin] = subset_node_map.size();
-        }
-        if (subset_node_map.count(dest)==0) {
-          subset_node_map[dest] = subset_node_map.size();
-        }
-      }
-
-    }
-
-
-    std::vector<bool> reachable(subset_node_map.size(), false);
-    reachable[subset_node_map[j]] = true;
-    while (true) {
-      auto conn_start = conn_iter;
-
-      bool found_new_node = false;
-      while (++conn_start != connections.end()) {
-        auto const& conn = *conn_start;
-        assert(conn.set == set);
-
-        // if the origin of this connection is reachable and its
-        // desitination is not, then it should be made reachable
-        if (reachable[subset_node_map[conn.origin]] &&
-            !reachable[subset_node_map[conn.dest]] &&
-            conn.type == ConnectionType::Normal) {
-          // if it is a normal node. if it is the origin of the
-          // proposed additional connection (i->j) then it would be
-          // a loop
-          if (conn.dest == i) {
-            // the destination of this reachable connection is
-            // the origin of the proposed connection. thus there
-            // exists a path from j -> i. So this will be a loop.
-            return true;
-          }
-          else {
-            reachable[subset_node_map[conn.dest]] = true;
-            found_new_node = true;
-          }
-        }
-      }
-      // no loop detected
-      if (!found_new_node) {
-        return false;
-      }
+void ConcurrentGPUNeuralNet::add_connections(Span<const Connection> new_connections) {
+  connections.reserve(connections.size() + new_connections.size());
+  for(auto& conn : new_connections) {
+    bool normal = conn.type == ConnectionType::Normal;
+    assert(!normal || !would_make_loop(conn.origin,conn.dest,conn.set));
+    connections.push_back(conn);
+    added_order.push_back(added_order.size());
+    loop_detector.add_connection(conn.origin,conn.dest,normal,conn.set);
+  }
+}
 
-    }
+void ConcurrentGPUNeuralNet::add_sorted_connections(Span<const Connection> new_connections) {
+  connections.reserve(connections.size() + new_connections.size());
+  for(auto& conn : new_connections) {
+    connections.push_back(conn);
+    added_order.push_back(added_order.size());
+    loop_detector.add_connection(conn.origin,conn.dest,conn.type == ConnectionType::Normal);
   }
 }
 
+bool ConcurrentGPUNeuralNet::would_make_loop(unsigned int i, unsigned int j, unsigned int set) {
+  return loop_detector.would_make_loop(i,j,set);
+}
+
 // TODO: implement gpu_smart_pointer to handle GPU memory according to RAII
 void ConcurrentGPUNeuralNet::synchronize() {
   cuda_assert(cudaMalloc((void**)&node_,nodes.size()*sizeof(_float_)));
   cuda_assert(cudaMemcpy(node_,nodes.data(),nodes.size()*sizeof(_float_),cudaMemcpyHostToDevice));
 
-  cuda_assert(cudaMalloc((void**)&origin_,connection_list.origin.size()*sizeof(unsigned int)));
-  cuda_assert(cudaMemcpy(origin_,connection_list.origin.data(),connection_list.origin.size()*sizeof(unsigned int),cudaMemcpyHostToDevice));
+  auto num_connections = plan.num_connections();
+  cuda_assert(cudaMalloc((void**)&origin_,num_connections*sizeof(unsigned int)));
+  cuda_assert(cudaMemcpy(origin_,plan.origins(),num_connections*sizeof(unsigned int),cudaMemcpyHostToDevice));
+
+  cuda_assert(cudaMalloc((void**)&dest_,num_connections*sizeof(unsigned int)));
+  cuda_assert(cudaMemcpy(dest_,plan.dests(),num_connections*sizeof(unsigned int),cudaMemcpyHostToDevice));
 
-  cuda_assert(cudaMalloc((void**)&dest_,connection_list.dest.size()*sizeof(unsigned int)));
-  cuda_assert(cudaMemcpy(dest_,connection_list.dest.data(),connection_list.dest.size()*sizeof(unsigned int),cudaMemcpyHostToDevice));
-  
-  cuda_assert(cudaMalloc((void**)&weight_,connection_list.weight.size()*sizeof(_float_)));
-  cuda_assert(cudaMemcpy(weight_,connection_list.weight.data(),connection_list.weight.size()*sizeof(_float_),cudaMemcpyHostToDevice));
+  cuda_assert(cudaMalloc((void**)&weight_,num_connections*sizeof(_float_)));
+  cuda_assert(cudaMemcpy(weight_,plan.weights(),num_connections*sizeof(_float_),cudaMemcpyHostToDevice));
 
-  cuda_assert(cudaMalloc((void**)&action_list_,action_list.size()*sizeof(unsigned int)));
-  cuda_assert(cudaMemcpy(action_list_,action_list.data(),action_list.size()*sizeof(unsigned int),cudaMemcpyHostToDevice));
+  auto& zero_out = plan.all_zero_out_nodes();
+  cuda_assert(cudaMalloc((void**)&zero_out_,zero_out.size()*sizeof(unsigned int)));
+  cuda_assert(cudaMemcpy(zero_out_,zero_out.data(),zero_out.size()*sizeof(unsigned int),cudaMemcpyHostToDevice));
+
+  auto& sigmoid = plan.all_sigmoid_nodes();
+  cuda_assert(cudaMalloc((void**)&sigmoid_,sigmoid.size()*sizeof(unsigned int)));
+  cuda_assert(cudaMemcpy(sigmoid_,sigmoid.data(),sigmoid.size()*sizeof(unsigned int),cudaMemcpyHostToDevice));
 }
 
 
@@ -557,41 +295,12 @@ void ConcurrentGPUNeuralNet::print_network(std::ostream& os) const {
   std::stringstream ss; ss.str("");
   ss << "Action List: \n\n";
 
-  auto i = 0u;
-  int how_many_zero_out = action_list[i++];
-  ss << "# Zero out: " << how_many_zero_out << "\n";
-  i += how_many_zero_out;
-
-  int how_many_sigmoid = action_list[i++];
-  ss << "# Sigmoid: " << how_many_sigmoid << "\n";
-  i += how_many_sigmoid;
-
-  std::vector<unsigned int> num_conn_to_apply;
-  int current_conn = 0;
-  while(i<action_list.size()) {
-    int how_many_conn = action_list[i++];
-    ss << "# Connections: " << how_many_conn << "\n";
-    current_conn += how_many_conn;
-    num_conn_to_apply.push_back(how_many_conn);
-
-    int how_many_zero_out = action_list[i++];
-    ss << "# Zero out: " << how_many_zero_out << "\n";
-    i += how_many_zero_out;
-
-    int how_many_sigmoid = action_list[i++];
-    ss << "# Sigmoid: " << how_many_sigmoid << "\n";
-    i += how_many_sigmoid;
+  for(auto step=0u; step<=plan.num_levels(); step++) {
+    ss << "# Zero out: " << plan.num_zero_out(step) << "\n";
+    ss << "# Sigmoid: " << plan.num_sigmoid(step) << "\n";
+    if(step < plan.num_levels()) {
+      ss << "# Connections: " << plan.level_size(step) << "\n";
+    }
   }
   os << ss.str();
-
-  // ss.str("");
-  // ss << "\nConnection sets:\n";
-  // int counter = 0;
-  // int num = num_conn_to_apply[counter];
-  // for (auto i=0u; i<connection_list.size(); i++) {
-  //   ss << connection_list.origin[i] << " -> " << connection_list.dest[i] << "\n";
-  //   if (i == num-1) { num += num_conn_to_apply[++counter]; ss << "\n";}
-  // }
-
-  // os << ss.str();
-}
\ No newline at end of file
+}
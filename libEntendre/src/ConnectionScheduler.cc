@@ -0,0 +1,196 @@
+#include "ConnectionScheduler.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+  // Compressed adjacency lists, indexed by (local) node number.
+  struct NodeLists {
+    NodeLists(size_t num_nodes) : offsets(num_nodes+1, 0) { ; }
+    std::vector<unsigned int> offsets;
+    std::vector<unsigned int> items;
+
+    const unsigned int* begin(unsigned int node) const { return &items[0] + offsets[node]; }
+    const unsigned int* end(unsigned int node) const { return &items[0] + offsets[node+1]; }
+  };
+
+  template<typename KeyFunc>
+  NodeLists build_node_lists(size_t num_nodes, size_t n, KeyFunc key) {
+    NodeLists lists(num_nodes);
+    lists.items.resize(n);
+    for(auto i=0u; i<n; i++) {
+      lists.offsets[key(i)+1]++;
+    }
+    for(auto node=0u; node<num_nodes; node++) {
+      lists.offsets[node+1] += lists.offsets[node];
+    }
+    std::vector<unsigned int> fill(lists.offsets.begin(), lists.offsets.end()-1);
+    for(auto i=0u; i<n; i++) {
+      lists.items[fill[key(i)]++] = i;
+    }
+    return lists;
+  }
+}
+
+void schedule_connection_sets(Connection* connections, size_t n, unsigned int* order) {
+  if(n == 0) {
+    return;
+  }
+
+  // Renumber the nodes touched by this range, so that sorting a small
+  // subnet of a large composite net does not scale with the full net.
+  std::vector<unsigned int> node_ids;
+  node_ids.reserve(2*n);
+  for(auto i=0u; i<n; i++) {
+    node_ids.push_back(connections[i].origin);
+    node_ids.push_back(connections[i].dest);
+  }
+  std::sort(node_ids.begin(), node_ids.end());
+  node_ids.erase(std::unique(node_ids.begin(), node_ids.end()), node_ids.end());
+  const size_t num_nodes = node_ids.size();
+
+  auto local_id = [&](unsigned int id) {
+    return std::lower_bound(node_ids.begin(), node_ids.end(), id) - node_ids.begin();
+  };
+  std::vector<unsigned int> origin(n);
+  std::vector<unsigned int> dest(n);
+  std::vector<bool> recurrent(n);
+  for(auto i=0u; i<n; i++) {
+    origin[i] = local_id(connections[i].origin);
+    dest[i] = local_id(connections[i].dest);
+    recurrent[i] = connections[i].type == ConnectionType::Recurrent;
+  }
+
+  auto incoming = build_node_lists(num_nodes, n, [&](unsigned int i) { return dest[i]; });
+  auto outgoing = build_node_lists(num_nodes, n, [&](unsigned int i) { return origin[i]; });
+
+  // Connections writing to the same destination form a chain.  A
+  // self-recurrent connection happens at the same time as zero-ing
+  // out, and so must occur first of all connections writing to that
+  // node.  The remaining connections are ordered by decreasing origin.
+  std::vector<unsigned int> chain_next(n, n);
+  std::vector<bool> has_chain_prev(n, false);
+  for(auto node=0u; node<num_nodes; node++) {
+    auto first = &incoming.items[0] + incoming.offsets[node];
+    auto last = &incoming.items[0] + incoming.offsets[node+1];
+    std::sort(first, last, [&](unsigned int a, unsigned int b) {
+        bool a_self = origin[a] == dest[a];
+        bool b_self = origin[b] == dest[b];
+        if(a_self != b_self) {
+          return a_self;
+        }
+        return origin[a] > origin[b];
+      });
+    for(auto iter = first; iter+1 < last; iter++) {
+      chain_next[*iter] = *(iter+1);
+      has_chain_prev[*(iter+1)] = true;
+    }
+  }
+
+  // Vertices are [0,n) for connections, then one "writes complete"
+  // vertex and one "recurrent reads complete" vertex per node.
+  const size_t written_vertex = n;
+  const size_t read_vertex = n + num_nodes;
+  const size_t num_vertices = n + 2*num_nodes;
+
+  std::vector<unsigned int> num_dependencies(num_vertices, 0);
+  std::vector<unsigned int> level(num_vertices, 0);
+  for(auto i=0u; i<n; i++) {
+    bool self_recurrent = origin[i] == dest[i];
+    if(recurrent[i]) {
+      // Must be read before anything overwrites the origin.
+      if(!self_recurrent) {
+        num_dependencies[read_vertex + origin[i]]++;
+      }
+    } else {
+      // Waits on all writes to the origin.
+      num_dependencies[i]++;
+    }
+    // All writes must complete before the destination is read.
+    num_dependencies[written_vertex + dest[i]]++;
+    // Waits on all recurrent reads of the destination.
+    num_dependencies[i]++;
+    if(has_chain_prev[i]) {
+      num_dependencies[i]++;
+    }
+  }
+
+  std::vector<unsigned int> ready;
+  ready.reserve(num_vertices);
+  for(auto v=0u; v<num_vertices; v++) {
+    if(num_dependencies[v] == 0) {
+      ready.push_back(v);
+    }
+  }
+
+  auto release = [&](unsigned int v, unsigned int min_level) {
+    level[v] = std::max(level[v], min_level);
+    if(--num_dependencies[v] == 0) {
+      ready.push_back(v);
+    }
+  };
+
+  size_t num_scheduled = 0;
+  for(size_t next=0; next<ready.size(); next++) {
+    unsigned int v = ready[next];
+    if(v < written_vertex) {
+      num_scheduled++;
+      if(recurrent[v] && origin[v] != dest[v]) {
+        release(read_vertex + origin[v], level[v]+1);
+      }
+      release(written_vertex + dest[v], level[v]+1);
+      if(chain_next[v] != n) {
+        release(chain_next[v], level[v]+1);
+      }
+    } else if(v < read_vertex) {
+      unsigned int node = v - written_vertex;
+      for(auto iter = outgoing.begin(node); iter != outgoing.end(node); iter++) {
+        if(!recurrent[*iter]) {
+          release(*iter, level[v]);
+        }
+      }
+    } else {
+      unsigned int node = v - read_vertex;
+      for(auto iter = incoming.begin(node); iter != incoming.end(node); iter++) {
+        release(*iter, level[v]);
+      }
+    }
+  }
+  if(num_scheduled != n) {
+    throw std::runtime_error("Connection scheduling failed, dependencies form a cycle");
+  }
+
+  for(auto i=0u; i<n; i++) {
+    connections[i].set = level[i];
+  }
+  sort_by_set(connections, n, order);
+}
+
+void sort_by_set(Connection* connections, size_t n, unsigned int* order) {
+  // Stable counting sort of the range by set number.
+  unsigned int num_sets = 0;
+  for(auto i=0u; i<n; i++) {
+    num_sets = std::max(num_sets, connections[i].set+1);
+  }
+  std::vector<unsigned int> set_offsets(num_sets+1, 0);
+  for(auto i=0u; i<n; i++) {
+    set_offsets[connections[i].set+1]++;
+  }
+  for(auto set=0u; set<num_sets; set++) {
+    set_offsets[set+1] += set_offsets[set];
+  }
+
+  std::vector<Connection> unsorted(connections, connections+n);
+  std::vector<unsigned int> unsorted_order;
+  if(order) {
+    unsorted_order.assign(order, order+n);
+  }
+  for(auto i=0u; i<n; i++) {
+    auto position = set_offsets[unsorted[i].set]++;
+    connections[position] = unsorted[i];
+    if(order) {
+      order[position] = unsorted_order[i];
+    }
+  }
+}
@@ -0,0 +1,91 @@
+#include "ExecutionPlan.hh"
+
+#include <algorithm>
+#include <cassert>
+
+ExecutionPlan::ExecutionPlan(const std::vector<NodeType>& node_types,
+                             const std::vector<Connection>& connections)
+  : n_nodes(node_types.size()) {
+
+  for(unsigned int i=0; i<node_types.size(); i++) {
+    switch(node_types[i]) {
+    case NodeType::Input:
+      inputs.push_back(i);
+      break;
+    case NodeType::Output:
+      outputs.push_back(i);
+      break;
+    case NodeType::Bias:
+      biases.push_back(i);
+      break;
+    case NodeType::Hidden:
+      break;
+    }
+  }
+
+  unsigned int num_levels = connections.size() ? connections.back().set+1 : 0;
+
+  origin.reserve(connections.size());
+  dest.reserve(connections.size());
+  weight.reserve(connections.size());
+  level_offsets.assign(num_levels+1, 0);
+  for(auto& conn : connections) {
+    assert(conn.set < num_levels);
+    origin.push_back(conn.origin);
+    dest.push_back(conn.dest);
+    weight.push_back(conn.weight);
+    level_offsets[conn.set+1]++;
+  }
+  for(unsigned int i=0; i<num_levels; i++) {
+    level_offsets[i+1] += level_offsets[i];
+  }
+
+  // A node is zeroed out once all recurrent connections reading its
+  // previous value are applied, and has the activation applied once
+  // all connections writing to it are applied.
+  std::vector<unsigned int> zero_out_step(n_nodes, 0);
+  std::vector<unsigned int> sigmoid_step(n_nodes, 0);
+  std::vector<bool> self_recurrent(n_nodes, false);
+
+  for(auto& conn : connections) {
+    if(conn.type == ConnectionType::Recurrent) {
+      zero_out_step[conn.origin] = std::max(zero_out_step[conn.origin], conn.set + 1);
+    }
+    sigmoid_step[conn.dest] = std::max(sigmoid_step[conn.dest], conn.set + 1);
+    if(conn.origin == conn.dest) {
+      self_recurrent[conn.origin] = true;
+    }
+  }
+
+  // Bucket the nodes by step, keeping node order within a step.
+  zero_out_offsets.assign(num_levels+2, 0);
+  sigmoid_offsets.assign(num_levels+2, 0);
+  for(unsigned int i=0; i<n_nodes; i++) {
+    if(IsSensor(node_types[i])) {
+      continue;
+    }
+    // A self-recurrent node is scaled in place instead of being zeroed.
+    if(!self_recurrent[i]) {
+      zero_out_offsets[zero_out_step[i]+1]++;
+    }
+    sigmoid_offsets[sigmoid_step[i]+1]++;
+  }
+  for(unsigned int step=0; step<=num_levels; step++) {
+    zero_out_offsets[step+1] += zero_out_offsets[step];
+    sigmoid_offsets[step+1] += sigmoid_offsets[step];
+  }
+
+  zero_out.resize(zero_out_offsets.back());
+  sigmoid.resize(sigmoid_offsets.back());
+  std::vector<unsigned int> next_zero_out(zero_out_offsets.begin(), zero_out_offsets.end()-1);
+  std::vector<unsigned int> next_sigmoid(sigmoid_offsets.begin(), sigmoid_offsets.end()-1);
+  for(unsigned int i=0; i<n_nodes; i++) {
+    if(IsSensor(node_types[i])) {
+      continue;
+    }
+    if(!self_recurrent[i]) {
+      zero_out[next_zero_out[zero_out_step[i]]++] = i;
+    }
+    sigmoid[next_sigmoid[sigmoid_step[i]]++] = i;
+  }
+}
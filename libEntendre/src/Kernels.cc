@@ -0,0 +1,395 @@
+#include "Kernels.hh"
+#include "Activations.hh"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KERNELS_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace {
+  typedef ActivationCoefficients C;
+}
+
+_float_ kernel_activate(Activation activation, _float_ val) {
+  switch(activation) {
+  case Activation::LogisticFast:
+    return LogisticFastActivation()(val);
+  case Activation::Tanh:
+    return TanhActivation()(val);
+  case Activation::Logistic:
+  default:
+    return LogisticActivation()(val);
+  }
+}
+
+static void kernel_activate_scalar(Activation activation, _float_* nodes,
+                                   const unsigned int* list, unsigned int n) {
+  for(auto i=0u; i<n; i++) {
+    nodes[list[i]] = kernel_activate(activation, nodes[list[i]]);
+  }
+}
+
+static void kernel_activate_scalar(Activation activation, _float_* values, unsigned int n) {
+  for(auto i=0u; i<n; i++) {
+    values[i] = kernel_activate(activation, values[i]);
+  }
+}
+
+void kernel_apply_connections_scalar(_float_* nodes,
+                                     const unsigned int* origin, const unsigned int* dest,
+                                     const _float_* weight, unsigned int n) {
+  for(auto i=0u; i<n; i++) {
+    if(origin[i] == dest[i]) {
+      // Special case for self-recurrent nodes
+      // Be sure not to zero-out before this step.
+      nodes[dest[i]] *= weight[i];
+    } else {
+      nodes[dest[i]] += weight[i]*nodes[origin[i]];
+    }
+  }
+}
+
+#ifdef KERNELS_X86_DISPATCH
+
+// The vector kernels handle the remainder with masked loads and
+// stores rather than falling back to the scalar loop, so that every
+// connection is rounded the same way (a fused multiply-add),
+// regardless of where it falls within a level.
+
+__attribute__((target("avx2,fma")))
+static inline __m256 apply_connections_avx2(const _float_* nodes, __m256i vorigin, __m256i vdest,
+                                            __m256 vweight, __m256 mask) {
+  __m256 origin_val = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), nodes, vorigin, mask, 4);
+  __m256 dest_val = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), nodes, vdest, mask, 4);
+
+  __m256 summed = _mm256_fmadd_ps(vweight, origin_val, dest_val);
+  __m256 scaled = _mm256_mul_ps(dest_val, vweight);
+  __m256 is_self = _mm256_castsi256_ps(_mm256_cmpeq_epi32(vorigin, vdest));
+  return _mm256_blendv_ps(summed, scaled, is_self);
+}
+
+__attribute__((target("avx2,fma")))
+static void kernel_apply_connections_avx2(_float_* nodes,
+                                          const unsigned int* origin, const unsigned int* dest,
+                                          const _float_* weight, unsigned int n) {
+  alignas(32) float result[8];
+  alignas(32) int dest_index[8];
+  const __m256 all = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+  auto i = 0u;
+  for(; i+8<=n; i+=8) {
+    __m256i vorigin = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(origin+i));
+    __m256i vdest = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest+i));
+    __m256 vweight = _mm256_loadu_ps(weight+i);
+
+    // AVX2 has no scatter
+    _mm256_store_ps(result, apply_connections_avx2(nodes, vorigin, vdest, vweight, all));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(dest_index), vdest);
+    for(auto j=0u; j<8; j++) {
+      nodes[dest_index[j]] = result[j];
+    }
+  }
+
+  if(i < n) {
+    const unsigned int remaining = n-i;
+    __m256i lane = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+    __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), lane);
+    __m256i vorigin = _mm256_maskload_epi32(reinterpret_cast<const int*>(origin+i), mask);
+    __m256i vdest = _mm256_maskload_epi32(reinterpret_cast<const int*>(dest+i), mask);
+    __m256 vweight = _mm256_maskload_ps(weight+i, mask);
+
+    _mm256_store_ps(result, apply_connections_avx2(nodes, vorigin, vdest, vweight, _mm256_castsi256_ps(mask)));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(dest_index), vdest);
+    for(auto j=0u; j<remaining; j++) {
+      nodes[dest_index[j]] = result[j];
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+static void kernel_apply_connections_avx512(_float_* nodes,
+                                            const unsigned int* origin, const unsigned int* dest,
+                                            const _float_* weight, unsigned int n) {
+  for(auto i=0u; i<n; i+=16) {
+    __mmask16 mask = (n-i >= 16) ? 0xFFFF : (1u << (n-i)) - 1;
+    __m512i vorigin = _mm512_maskz_loadu_epi32(mask, origin+i);
+    __m512i vdest = _mm512_maskz_loadu_epi32(mask, dest+i);
+    __m512 vweight = _mm512_maskz_loadu_ps(mask, weight+i);
+
+    __m512 origin_val = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, vorigin, nodes, 4);
+    __m512 dest_val = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, vdest, nodes, 4);
+
+    __m512 summed = _mm512_fmadd_ps(vweight, origin_val, dest_val);
+    __m512 scaled = _mm512_mul_ps(dest_val, vweight);
+    __mmask16 is_self = _mm512_cmpeq_epi32_mask(vorigin, vdest);
+
+    _mm512_mask_i32scatter_ps(nodes, mask, vdest, _mm512_mask_blend_ps(is_self, summed, scaled), 4);
+  }
+}
+
+// The activations follow the functors of Activations.hh operation for
+// operation, except that multiply-adds are fused.
+
+__attribute__((target("avx2,fma")))
+static inline __m256 exp_avx2(__m256 x) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(C::exp_lo)), _mm256_set1_ps(C::exp_hi));
+  __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(C::log2e)),
+                             _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(C::ln2_hi), x);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(C::ln2_lo), r);
+
+  __m256 p = _mm256_set1_ps(C::exp_p0);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(C::exp_p1));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(C::exp_p2));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(C::exp_p3));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(C::exp_p4));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(C::exp_p5));
+  __m256 y = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+  __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(bits));
+}
+
+template<Activation A>
+__attribute__((target("avx2,fma")))
+static inline __m256 activate_avx2(__m256 x) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  switch(A) {
+  case Activation::LogisticFast: {
+    const __m256 half = _mm256_set1_ps(0.5f);
+    __m256 t = _mm256_mul_ps(half, x);
+    t = _mm256_min_ps(_mm256_max_ps(t, _mm256_set1_ps(-C::tanh_clamp)), _mm256_set1_ps(C::tanh_clamp));
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 num = _mm256_add_ps(t2, _mm256_set1_ps(C::tanh_n2));
+    num = _mm256_fmadd_ps(num, t2, _mm256_set1_ps(C::tanh_n1));
+    num = _mm256_fmadd_ps(num, t2, _mm256_set1_ps(C::tanh_n0));
+    num = _mm256_mul_ps(num, t);
+    __m256 den = _mm256_fmadd_ps(_mm256_set1_ps(C::tanh_d3), t2, _mm256_set1_ps(C::tanh_d2));
+    den = _mm256_fmadd_ps(den, t2, _mm256_set1_ps(C::tanh_d1));
+    den = _mm256_fmadd_ps(den, t2, _mm256_set1_ps(C::tanh_d0));
+    return _mm256_fmadd_ps(half, _mm256_div_ps(num, den), half);
+  }
+  case Activation::Tanh: {
+    __m256 e = exp_avx2(_mm256_add_ps(x, x));
+    return _mm256_sub_ps(one, _mm256_div_ps(_mm256_set1_ps(2.0f), _mm256_add_ps(one, e)));
+  }
+  case Activation::Logistic:
+  default: {
+    __m256 e = exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), x));
+    return _mm256_div_ps(one, _mm256_add_ps(one, e));
+  }
+  }
+}
+
+template<Activation A>
+__attribute__((target("avx2,fma")))
+static void kernel_activate_avx2(_float_* nodes, const unsigned int* list, unsigned int n) {
+  alignas(32) float result[8];
+  alignas(32) int index[8];
+
+  auto i = 0u;
+  for(; i+8<=n; i+=8) {
+    __m256i vindex = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(list+i));
+    _mm256_store_ps(result, activate_avx2<A>(_mm256_i32gather_ps(nodes, vindex, 4)));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(index), vindex);
+    for(auto j=0u; j<8; j++) {
+      nodes[index[j]] = result[j];
+    }
+  }
+
+  if(i < n) {
+    const unsigned int remaining = n-i;
+    __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), _mm256_setr_epi32(0,1,2,3,4,5,6,7));
+    __m256i vindex = _mm256_maskload_epi32(reinterpret_cast<const int*>(list+i), mask);
+    __m256 val = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), nodes, vindex, _mm256_castsi256_ps(mask), 4);
+    _mm256_store_ps(result, activate_avx2<A>(val));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(index), vindex);
+    for(auto j=0u; j<remaining; j++) {
+      nodes[index[j]] = result[j];
+    }
+  }
+}
+
+template<Activation A>
+__attribute__((target("avx2,fma")))
+static void kernel_activate_avx2(_float_* values, unsigned int n) {
+  auto i = 0u;
+  for(; i+8<=n; i+=8) {
+    _mm256_storeu_ps(values+i, activate_avx2<A>(_mm256_loadu_ps(values+i)));
+  }
+
+  if(i < n) {
+    __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(n-i), _mm256_setr_epi32(0,1,2,3,4,5,6,7));
+    _mm256_maskstore_ps(values+i, mask, activate_avx2<A>(_mm256_maskload_ps(values+i, mask)));
+  }
+}
+
+// GCC's unmasked AVX-512 intrinsics start from an undefined register,
+// which -Wmaybe-uninitialized mistakes for a read of one.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+static inline __m512 exp_avx512(__m512 x) {
+  x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(C::exp_lo)), _mm512_set1_ps(C::exp_hi));
+  __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(C::log2e)),
+                                  _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(C::ln2_hi), x);
+  r = _mm512_fnmadd_ps(n, _mm512_set1_ps(C::ln2_lo), r);
+
+  __m512 p = _mm512_set1_ps(C::exp_p0);
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(C::exp_p1));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(C::exp_p2));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(C::exp_p3));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(C::exp_p4));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(C::exp_p5));
+  __m512 y = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+  __m512i bits = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+  return _mm512_mul_ps(y, _mm512_castsi512_ps(bits));
+}
+
+template<Activation A>
+__attribute__((target("avx512f")))
+static inline __m512 activate_avx512(__m512 x) {
+  const __m512 one = _mm512_set1_ps(1.0f);
+  switch(A) {
+  case Activation::LogisticFast: {
+    const __m512 half = _mm512_set1_ps(0.5f);
+    __m512 t = _mm512_mul_ps(half, x);
+    t = _mm512_min_ps(_mm512_max_ps(t, _mm512_set1_ps(-C::tanh_clamp)), _mm512_set1_ps(C::tanh_clamp));
+    __m512 t2 = _mm512_mul_ps(t, t);
+    __m512 num = _mm512_add_ps(t2, _mm512_set1_ps(C::tanh_n2));
+    num = _mm512_fmadd_ps(num, t2, _mm512_set1_ps(C::tanh_n1));
+    num = _mm512_fmadd_ps(num, t2, _mm512_set1_ps(C::tanh_n0));
+    num = _mm512_mul_ps(num, t);
+    __m512 den = _mm512_fmadd_ps(_mm512_set1_ps(C::tanh_d3), t2, _mm512_set1_ps(C::tanh_d2));
+    den = _mm512_fmadd_ps(den, t2, _mm512_set1_ps(C::tanh_d1));
+    den = _mm512_fmadd_ps(den, t2, _mm512_set1_ps(C::tanh_d0));
+    return _mm512_fmadd_ps(half, _mm512_div_ps(num, den), half);
+  }
+  case Activation::Tanh: {
+    __m512 e = exp_avx512(_mm512_add_ps(x, x));
+    return _mm512_sub_ps(one, _mm512_div_ps(_mm512_set1_ps(2.0f), _mm512_add_ps(one, e)));
+  }
+  case Activation::Logistic:
+  default: {
+    __m512 e = exp_avx512(_mm512_sub_ps(_mm512_setzero_ps(), x));
+    return _mm512_div_ps(one, _mm512_add_ps(one, e));
+  }
+  }
+}
+
+template<Activation A>
+__attribute__((target("avx512f")))
+static void kernel_activate_avx512(_float_* nodes, const unsigned int* list, unsigned int n) {
+  for(auto i=0u; i<n; i+=16) {
+    __mmask16 mask = (n-i >= 16) ? 0xFFFF : (1u << (n-i)) - 1;
+    __m512i vindex = _mm512_maskz_loadu_epi32(mask, list+i);
+    __m512 val = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, vindex, nodes, 4);
+    _mm512_mask_i32scatter_ps(nodes, mask, vindex, activate_avx512<A>(val), 4);
+  }
+}
+
+template<Activation A>
+__attribute__((target("avx512f")))
+static void kernel_activate_avx512(_float_* values, unsigned int n) {
+  for(auto i=0u; i<n; i+=16) {
+    __mmask16 mask = (n-i >= 16) ? 0xFFFF : (1u << (n-i)) - 1;
+    __m512 val = _mm512_maskz_loadu_ps(mask, values+i);
+    _mm512_mask_storeu_ps(values+i, mask, activate_avx512<A>(val));
+  }
+}
+
+#pragma GCC diagnostic pop
+
+// Binds the activation at compile time, so that the dispatch below
+// picks one function per call rather than branching per vector.
+#define KERNELS_DEFINE_ACTIVATE(isa)                                     \
+  static void kernel_activate_##isa(Activation activation, _float_* nodes, \
+                                    const unsigned int* list, unsigned int n) { \
+    switch(activation) {                                                 \
+    case Activation::LogisticFast:                                       \
+      return kernel_activate_##isa<Activation::LogisticFast>(nodes, list, n); \
+    case Activation::Tanh:                                               \
+      return kernel_activate_##isa<Activation::Tanh>(nodes, list, n);    \
+    case Activation::Logistic:                                           \
+    default:                                                             \
+      return kernel_activate_##isa<Activation::Logistic>(nodes, list, n); \
+    }                                                                    \
+  }                                                                      \
+  static void kernel_activate_##isa(Activation activation, _float_* values, unsigned int n) { \
+    switch(activation) {                                                 \
+    case Activation::LogisticFast:                                       \
+      return kernel_activate_##isa<Activation::LogisticFast>(values, n); \
+    case Activation::Tanh:                                               \
+      return kernel_activate_##isa<Activation::Tanh>(values, n);         \
+    case Activation::Logistic:                                           \
+    default:                                                             \
+      return kernel_activate_##isa<Activation::Logistic>(values, n);     \
+    }                                                                    \
+  }
+
+KERNELS_DEFINE_ACTIVATE(avx2)
+KERNELS_DEFINE_ACTIVATE(avx512)
+
+#undef KERNELS_DEFINE_ACTIVATE
+
+#endif
+
+namespace {
+  typedef void (*ApplyConnectionsKernel)(_float_*, const unsigned int*, const unsigned int*,
+                                         const _float_*, unsigned int);
+  typedef void (*ActivateListKernel)(Activation, _float_*, const unsigned int*, unsigned int);
+  typedef void (*ActivateRangeKernel)(Activation, _float_*, unsigned int);
+
+  struct KernelSelection {
+    KernelSelection() {
+#ifdef KERNELS_X86_DISPATCH
+      __builtin_cpu_init();
+      if(__builtin_cpu_supports("avx512f")) {
+        apply_connections = kernel_apply_connections_avx512;
+        activate_list = kernel_activate_avx512;
+        activate_range = kernel_activate_avx512;
+        name = "avx512f";
+        return;
+      }
+      if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        apply_connections = kernel_apply_connections_avx2;
+        activate_list = kernel_activate_avx2;
+        activate_range = kernel_activate_avx2;
+        name = "avx2";
+        return;
+      }
+#endif
+    }
+    ApplyConnectionsKernel apply_connections = kernel_apply_connections_scalar;
+    ActivateListKernel activate_list = kernel_activate_scalar;
+    ActivateRangeKernel activate_range = kernel_activate_scalar;
+    const char* name = "scalar";
+  };
+
+  const KernelSelection& selected_kernels() {
+    static const KernelSelection selection;
+    return selection;
+  }
+}
+
+void kernel_apply_connections(_float_* nodes,
+                              const unsigned int* origin, const unsigned int* dest,
+                              const _float_* weight, unsigned int n) {
+  selected_kernels().apply_connections(nodes, origin, dest, weight, n);
+}
+
+void kernel_activate(Activation activation, _float_* nodes,
+                     const unsigned int* list, unsigned int n) {
+  selected_kernels().activate_list(activation, nodes, list, n);
+}
+
+void kernel_activate(Activation activation, _float_* values, unsigned int n) {
+  selected_kernels().activate_range(activation, values, n);
+}
+
+const char* kernel_instruction_set() {
+  return selected_kernels().name;
+}
@@ -0,0 +1,76 @@
+#include "LoopDetector.hh"
+
+#include <algorithm>
+
+void LoopDetector::add_connection(unsigned int origin, unsigned int dest, bool normal,
+                                  unsigned int set) {
+  if(!has_run || set != run_set) {
+    has_run = true;
+    run_set = set;
+    run_first_link = links.size();
+  }
+
+  if(!normal) {
+    return;
+  }
+
+  if(origin >= first_link.size()) {
+    first_link.resize(origin+1, -1);
+  }
+  links.push_back({dest, first_link[origin]});
+  first_link[origin] = links.size()-1;
+}
+
+bool LoopDetector::would_make_loop(unsigned int origin, unsigned int dest, unsigned int set,
+                                   Search& search) const {
+  // handle the case of a recurrent connection to itself up front
+  if(origin == dest) {
+    return true;
+  }
+
+  // Links before this one are not followed.
+  int first = 0;
+  if(set != std::numeric_limits<unsigned int>::max()) {
+    if(!has_run || run_set != set) {
+      return false;
+    }
+    first = run_first_link;
+  }
+
+  // A node with no outgoing links cannot lead anywhere.
+  if(dest >= first_link.size()) {
+    return false;
+  }
+
+  auto& stamps = search.stamps;
+  auto& current_stamp = search.current_stamp;
+  auto& stack = search.stack;
+  if(stamps.size() < first_link.size()) {
+    stamps.resize(first_link.size(), current_stamp);
+  }
+  if(++current_stamp == 0) {
+    std::fill(stamps.begin(), stamps.end(), 0);
+    current_stamp = 1;
+  }
+
+  // Search for the origin, starting from the destination.
+  stack.clear();
+  stack.push_back(dest);
+  stamps[dest] = current_stamp;
+  while(!stack.empty()) {
+    unsigned int node = stack.back();
+    stack.pop_back();
+
+    for(int i = first_link[node]; i >= first; i = links[i].next) {
+      unsigned int next = links[i].dest;
+      if(next == origin) {
+        return true;
+      }
+      if(next < first_link.size() && stamps[next] != current_stamp) {
+        stamps[next] = current_stamp;
+        stack.push_back(next);
+      }
+    }
+  }
+  return false;
+}
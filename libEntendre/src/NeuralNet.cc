@@ -1,4 +1,5 @@
 #include "NeuralNet.hh"
+#include "Kernels.hh"
 
 #include <cassert>
 #include <iostream>
@@ -10,17 +11,20 @@
 
 
 _float_ NeuralNet::sigmoid(_float_ val) const {
-  return (sigma) ? sigma(val) :
-    // Logistic curve
-    1/(1 + std::exp(-val));
+  return (sigma) ? sigma(val) : kernel_activate(activation, val);
   // Other options for a sigmoid curve
   //val/std::sqrt(1+val*val);
-  //std::tanh(val);
   //std::erf((std::sqrt(M_PI)/2)*val);
   //(2/M_PI) * std::atan((M_PI/2)*val);
   //val/(1+std::abs(val));
 }
 
+std::vector<_float_> NeuralNet::evaluate(const std::vector<_float_>& inputs) {
+  std::vector<_float_> outputs(num_outputs());
+  evaluate(inputs, outputs);
+  return outputs;
+}
+
 std::ostream& operator<<(std::ostream& os, const NeuralNet& net) {
   net.print_network(os);
   return os;
@@ -0,0 +1,115 @@
+#include "PopulationBatchNet.hh"
+
+#include "ConnectionScheduler.hh"
+#include "Kernels.hh"
+
+#include <algorithm>
+#include <cassert>
+
+unsigned int PopulationBatchNet::add_network(NeuralNet& net) {
+  const unsigned int node_offset = node_types.size();
+  unsigned int net_inputs = 0;
+  unsigned int net_outputs = 0;
+  for(auto i=0u; i<net.num_nodes(); i++) {
+    NodeType type = net.get_node_type(i);
+    net_inputs += IsInput(type);
+    net_outputs += IsOutput(type);
+    node_types.push_back(type);
+  }
+  node_offsets.push_back(node_types.size());
+  input_offsets.push_back(input_offsets.back() + net_inputs);
+  output_offsets.push_back(output_offsets.back() + net_outputs);
+
+  // Levels are scheduled per network, as the networks share no nodes.
+  const unsigned int first = connections.size();
+  for(auto i=0u; i<net.num_connections(); i++) {
+    Connection conn = net.get_connection(i);
+    conn.origin += node_offset;
+    conn.dest += node_offset;
+    connections.push_back(conn);
+  }
+  schedule_connection_sets(connections.data()+first, connections.size()-first);
+
+  plan_built = false;
+  return num_networks()-1;
+}
+
+void PopulationBatchNet::build_plan() {
+  // Merge the levels of all networks, keeping each network's
+  // connections in the order they were scheduled.
+  std::stable_sort(connections.begin(), connections.end(),
+                   [](const Connection& a, const Connection& b) { return a.set < b.set; });
+  plan = ExecutionPlan(node_types, connections);
+
+  nodes.assign(node_types.size(), 0);
+  for(auto bias : plan.bias_nodes()) {
+    nodes[bias] = 1;
+  }
+  plan_built = true;
+}
+
+void PopulationBatchNet::evaluate(Span<const _float_> inputs, Span<_float_> outputs) {
+  if(!plan_built) {
+    build_plan();
+  }
+  propagate(inputs);
+  read_outputs(outputs);
+}
+
+void PopulationBatchNet::evaluate(Span<const _float_> inputs, Span<_float_> outputs,
+                                  const std::vector<bool>& active) {
+  assert(active.size() == num_networks());
+  if(!plan_built) {
+    build_plan();
+  }
+
+  saved_nodes.clear();
+  for(auto n=0u; n<num_networks(); n++) {
+    if(!active[n]) {
+      saved_nodes.insert(saved_nodes.end(), nodes.begin() + node_offsets[n],
+                         nodes.begin() + node_offsets[n+1]);
+    }
+  }
+
+  propagate(inputs);
+
+  auto saved = saved_nodes.begin();
+  for(auto n=0u; n<num_networks(); n++) {
+    if(!active[n]) {
+      auto size = node_offsets[n+1] - node_offsets[n];
+      std::copy(saved, saved + size, nodes.begin() + node_offsets[n]);
+      saved += size;
+    }
+  }
+
+  read_outputs(outputs);
+}
+
+void PopulationBatchNet::propagate(Span<const _float_> inputs) {
+  auto& input_nodes = plan.input_nodes();
+  assert(inputs.size() == input_nodes.size());
+
+  for(auto k=0u; k<input_nodes.size(); k++) {
+    nodes[input_nodes[k]] = inputs[k];
+  }
+
+  for(auto step=0u; step<=plan.num_levels(); step++) {
+    const unsigned int* zero_out = plan.zero_out_nodes(step);
+    for(auto i=0u; i<plan.num_zero_out(step); i++) {
+      nodes[zero_out[i]] = 0;
+    }
+    kernel_activate(activation, nodes.data(), plan.sigmoid_nodes(step), plan.num_sigmoid(step));
+    if(step < plan.num_levels()) {
+      auto first = plan.level_begin(step);
+      kernel_apply_connections(nodes.data(), plan.origins()+first, plan.dests()+first, plan.weights()+first, plan.level_size(step));
+    }
+  }
+}
+
+void PopulationBatchNet::read_outputs(Span<_float_> outputs) const {
+  auto& output_nodes = plan.output_nodes();
+  assert(outputs.size() == output_nodes.size());
+  for(auto k=0u; k<output_nodes.size(); k++) {
+    outputs[k] = nodes[output_nodes[k]];
+  }
+}
@@ -1,40 +1,70 @@
 #pragma once
 #include "NeuralNet.hh"
 #include "Genome.hh"
+#include "ThreadPool.hh"
 
-template<typename NetType>
-std::unique_ptr<NeuralNet> BuildCompositeNet(const std::vector<Genome*>& genomes, bool hetero_inputs) {
-  auto net = std::make_unique<NetType>();
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
-  std::vector<std::unordered_set<unsigned int>> exclusion_lists(genomes.size());
+/// Builds networks holding a subnet for each genome, reusing the subnets of earlier builds
+/**
+   The connections of genome n are in set n.  If pool is given, each
+     genome is analysed, and its connections converted and sorted, on
+     the threads of the pool.
 
+   Sorting the connections of a subnet only depends on the structure of
+     its genome.  The sorted connections of each subnet are kept, by
+     Genome::StructuralHash, until the next build.  A genome with the
+     same structure as one of the previous build, such as a champion
+     or a child differing only in its weights, is then added already
+     sorted, with the weights of its own genes, rather than being
+     analysed and sorted again.  The endpoints of each reused connection
+     are checked against the genome's genes, so that a genome whose hash
+     collides with another structure is analysed as a new subnet.
 
-  for (auto i=0u; i<genomes.size(); i++) {
-    auto& genome = *genomes[i];
+   Subnets are kept only for the genomes of the latest build, so the
+     memory used follows the size of the population.  Only one build may
+     run at a time.
+ */
+template<typename NetType>
+class CompositeNetBuilder {
+public:
+  std::unique_ptr<NeuralNet> build(const std::vector<Genome*>& genomes, bool hetero_inputs,
+                                   ThreadPool* pool=nullptr);
 
-    genome.AssertInputNodesFirst();
-    genome.AssertNoConnectionsToInput();
+  /// Number of distinct subnet structures kept from the last build
+  size_t num_cached() const { return compiled.size(); }
 
+private:
+  /// Connection of a subnet, numbering nodes as in its genome
+  struct SubnetConnection {
+    unsigned int origin;
+    unsigned int dest;
+    ConnectionType type;
+    unsigned int set;
+    // Index of the gene among the enabled genes
+    unsigned int gene;
+  };
+  typedef std::vector<SubnetConnection> Subnet;
 
-    ReachabilityChecker checker(genome.node_genes.size(),genome.num_inputs);
-    for(auto& gene : genome.connection_genes) {
-      if (gene.enabled) {
-        int i = genome.node_lookup.at(gene.origin);
-        int j = genome.node_lookup.at(gene.dest);
-        checker.AddConnection(i,j);
-      }
-    }
+  // Sorted connections of each subnet of the last build, by structural hash.
+  std::unordered_map<unsigned long, std::shared_ptr<const Subnet> > compiled;
+};
 
-    // use reachability checker to determine if a node is unconnected
-    std::unordered_set<unsigned int>& exclusions = exclusion_lists[i];
-    for (auto n=0u; n<genome.node_genes.size(); n++) {
-      // if the node is not reachable from either inputs
-      // or outputs, add to the exclusion list
-      if (!genome.ConnectivityCheck(n,checker)) {
-        exclusions.insert(n);
-      }
+template<typename NetType>
+std::unique_ptr<NeuralNet> CompositeNetBuilder<NetType>::build(const std::vector<Genome*>& genomes,
+                                                               bool hetero_inputs, ThreadPool* pool) {
+  auto net = std::make_unique<NetType>();
+
+  auto parallel_for = [pool](size_t n, auto&& func) {
+    if (pool) {
+      pool->parallel_for(n, 1, func);
+    } else {
+      func(0, n);
     }
-  }
+  };
 
   // manually add single bias node
   net->add_node(NodeType::Bias); // first
@@ -45,7 +75,7 @@ std::unique_ptr<NeuralNet> BuildCompositeNet(const std::vector<Genome*>& genomes
 
     // add all inputs assuming they are heterogenous across networks
     if (hetero_inputs || i==0) {
-      for (auto& gene : genome.node_genes) {
+      for (auto& gene : genome.NodeGenes()) {
         if (IsInput(gene.type)) {
           net->add_node(gene.type);
         }
@@ -60,7 +90,7 @@ std::unique_ptr<NeuralNet> BuildCompositeNet(const std::vector<Genome*>& genomes
     auto& genome = *genomes[i];
 
     // add all outputs
-    for (auto& gene : genome.node_genes) {
+    for (auto& gene : genome.NodeGenes()) {
       if (gene.type == NodeType::Output) {
         net->add_node(gene.type);
         num_outputs++;
@@ -74,7 +104,7 @@ std::unique_ptr<NeuralNet> BuildCompositeNet(const std::vector<Genome*>& genomes
     auto& genome = *genomes[i];
 
     // add all hidden nodes
-    for (auto& gene : genome.node_genes) {
+    for (auto& gene : genome.NodeGenes()) {
       if (gene.type == NodeType::Hidden) {
         net->add_node(gene.type);
       }
@@ -82,85 +112,228 @@ std::unique_ptr<NeuralNet> BuildCompositeNet(const std::vector<Genome*>& genomes
 
   }
 
-  // add connections
+  // first composite node of each subnet's inputs, outputs and hidden nodes
   auto num_subnets = genomes.size();
   auto num_sensors_per_subnet = genomes[0]->num_inputs; // includes bias automatically
   auto num_outputs_per_subnet = num_outputs/num_subnets;
 
-  auto subnet_input_node = 0;
-  auto subnet_output_node = (hetero_inputs) ? num_subnets*(num_sensors_per_subnet-1) + 1 : num_sensors_per_subnet;
-  auto subnet_hidden_node = subnet_output_node + num_subnets*num_outputs_per_subnet;
-
-  for (auto n=0u; n<genomes.size(); n++) {
-    auto& genome = *genomes[n];
-    auto num_hidden = genome.node_genes.size() - num_sensors_per_subnet - num_outputs_per_subnet;
-
-
-    for(auto& gene : genome.connection_genes) {
-      if (gene.enabled) {
-        int i = genome.node_lookup.at(gene.origin);
-        int j = genome.node_lookup.at(gene.dest);
-
-        int i_composite;
-        int j_composite;
-        // assumes inputs are before all other nodes, outputs are before hidden, hidden are the last nodes
-        if (hetero_inputs) {
-          i_composite
-            = (IsBias(genome.node_genes[i].type)) ?  0
-            : (IsInput(genome.node_genes[i].type)) ?  i + subnet_input_node
-            : (IsOutput(genome.node_genes[i].type)) ? (i-num_sensors_per_subnet) + subnet_output_node
-            : (i-num_sensors_per_subnet-num_outputs_per_subnet) + subnet_hidden_node; // hidden
-          j_composite
-            = (IsBias(genome.node_genes[j].type)) ?  0
-            : (IsInput(genome.node_genes[j].type)) ?  j + subnet_input_node
-            : (IsOutput(genome.node_genes[j].type)) ? (j-num_sensors_per_subnet) + subnet_output_node
-            : (j-num_sensors_per_subnet-num_outputs_per_subnet) + subnet_hidden_node; // hidden
-        } else {
-          i_composite
-            = (IsSensor(genome.node_genes[i].type)) ?  i
-            : (IsOutput(genome.node_genes[i].type)) ? (i-num_sensors_per_subnet) + subnet_output_node
-            : (i-num_sensors_per_subnet-num_outputs_per_subnet) + subnet_hidden_node; // hidden
-          j_composite
-            = (IsSensor(genome.node_genes[j].type)) ?  j
-            : (IsOutput(genome.node_genes[j].type)) ? (j-num_sensors_per_subnet) + subnet_output_node
-            : (j-num_sensors_per_subnet-num_outputs_per_subnet) + subnet_hidden_node; // hidden
+  std::vector<unsigned int> input_offsets(num_subnets);
+  std::vector<unsigned int> output_offsets(num_subnets);
+  std::vector<unsigned int> hidden_offsets(num_subnets);
+  {
+    auto subnet_input_node = 0;
+    auto subnet_output_node = (hetero_inputs) ? num_subnets*(num_sensors_per_subnet-1) + 1 : num_sensors_per_subnet;
+    auto subnet_hidden_node = subnet_output_node + num_subnets*num_outputs_per_subnet;
+    for (auto n=0u; n<num_subnets; n++) {
+      input_offsets[n] = subnet_input_node;
+      output_offsets[n] = subnet_output_node;
+      hidden_offsets[n] = subnet_hidden_node;
+
+      // increment the node pointers by the number of nodes of a specific type for the current subnet
+      auto num_hidden = genomes[n]->NodeGenes().size() - num_sensors_per_subnet - num_outputs_per_subnet;
+      if (hetero_inputs){ subnet_input_node  += (num_sensors_per_subnet-1); }
+      subnet_output_node += num_outputs_per_subnet;
+      subnet_hidden_node += num_hidden;
+    }
+  }
+
+  // composite node of node i of subnet n
+  // assumes inputs are before all other nodes, outputs are before hidden, hidden are the last nodes
+  auto composite_index = [&](unsigned int n, unsigned int i) -> unsigned int {
+    auto type = genomes[n]->NodeGenes()[i].type;
+    if (hetero_inputs) {
+      return (IsBias(type)) ?  0
+        : (IsInput(type)) ?  i + input_offsets[n]
+        : (IsOutput(type)) ? (i-num_sensors_per_subnet) + output_offsets[n]
+        : (i-num_sensors_per_subnet-num_outputs_per_subnet) + hidden_offsets[n]; // hidden
+    } else {
+      return (IsSensor(type)) ?  i
+        : (IsOutput(type)) ? (i-num_sensors_per_subnet) + output_offsets[n]
+        : (i-num_sensors_per_subnet-num_outputs_per_subnet) + hidden_offsets[n]; // hidden
+    }
+  };
+
+  // Convert the connections of each subnet independently, either from
+  // the sorted subnet of an earlier build, or from the genome.  Each
+  // subnet is its own set, so its connections close the same loops as
+  // in the genome's checker.
+  std::vector<unsigned long> keys(num_subnets);
+  std::vector<std::shared_ptr<const Subnet> > subnets(num_subnets);
+  std::vector<Subnet> new_subnets(num_subnets);
+  std::vector<std::vector<Connection>> subnet_connections(num_subnets);
+  parallel_for(num_subnets, [&](size_t begin, size_t end) {
+    for (auto n=begin; n<end; n++) {
+      auto& genome = *genomes[n];
+      auto& connections = subnet_connections[n];
+
+      keys[n] = genome.StructuralHash();
+      auto found = compiled.find(keys[n]);
+      if (found != compiled.end()) {
+        std::vector<_float_> weights;
+        std::vector<std::pair<unsigned int, unsigned int> > endpoints;
+        weights.reserve(genome.connection_genes.size());
+        endpoints.reserve(genome.connection_genes.size());
+        for (auto& gene : genome.connection_genes) {
+          if (gene.enabled) {
+            weights.push_back(gene.weight);
+            endpoints.emplace_back(genome.NodeIndex(gene.origin), genome.NodeIndex(gene.dest));
+          }
+        }
+
+        // Structural hashes may collide, so each connection is checked
+        // against the gene it takes its weight from.
+        bool matches = true;
+        connections.reserve(found->second->size());
+        for (auto& conn : *found->second) {
+          if (conn.gene >= endpoints.size() ||
+              endpoints[conn.gene] != std::make_pair(conn.origin, conn.dest)) {
+            matches = false;
+            break;
+          }
+          connections.emplace_back(composite_index(n,conn.origin),composite_index(n,conn.dest),
+                                   conn.type,weights[conn.gene],conn.set);
+        }
+        if (matches) {
+          subnets[n] = found->second;
+          continue;
+        }
+        connections.clear();
+      }
+
+      genome.AssertInputNodesFirst();
+      genome.AssertNoConnectionsToInput();
+
+      auto checker = genome.EnabledReachability();
+
+      // use reachability checker to determine if a node is unconnected
+      std::unordered_set<unsigned int> exclusions;
+      for (auto i=0u; i<genome.NodeGenes().size(); i++) {
+        // if the node is not reachable from either inputs
+        // or outputs, add to the exclusion list
+        if (!genome.ConnectivityCheck(i,*checker)) {
+          exclusions.insert(i);
         }
+      }
 
-        if(exclusion_lists[n].count(i) == 0 &&
-           exclusion_lists[n].count(j) == 0) {
-          net->add_connection(i_composite,j_composite,gene.weight,n);
+      auto& subnet = new_subnets[n];
+      subnet.reserve(genome.connection_genes.size());
+      connections.reserve(genome.connection_genes.size());
+      unsigned int enabled_index = 0;
+      for(auto& gene : genome.connection_genes) {
+        if (!gene.enabled) {
+          continue;
         }
+        auto gene_index = enabled_index++;
+        unsigned int i = genome.NodeIndex(gene.origin);
+        unsigned int j = genome.NodeIndex(gene.dest);
+        if(exclusions.count(i) || exclusions.count(j)) {
+          continue;
+        }
+
+        auto type = checker->HasRecurrentConnection(i,j) ? ConnectionType::Recurrent : ConnectionType::Normal;
+        subnet.push_back({i, j, type, static_cast<unsigned int>(n), gene_index});
+        connections.emplace_back(composite_index(n,i),composite_index(n,j),type,gene.weight,n);
       }
     }
+  });
+
+  // Add the subnets sorted before, then the new ones, so that the range
+  // sorted last is a new one whenever there is one.
+  std::pair<unsigned int, unsigned int> last_sorted_range;
+  unsigned int first = 0;
+  for (auto n=0u; n<num_subnets; n++) {
+    auto& connections = subnet_connections[n];
+    if (subnets[n] && !connections.empty()) {
+      net->add_sorted_connections(connections);
+      last_sorted_range = {first, connections.size()};
+      first += connections.size();
+    }
+  }
 
-    // increment the node pointers by the number of nodes of a specific type for the current subnet
-    if (hetero_inputs){ subnet_input_node  += (num_sensors_per_subnet-1); }
-    subnet_output_node += num_outputs_per_subnet;
-    subnet_hidden_node += num_hidden;
+  // add connections of new subnets, in order of set
+  auto first_new = first;
+  std::vector<std::pair<unsigned int, unsigned int>> ranges;
+  std::vector<unsigned int> range_subnets;
+  for (auto n=0u; n<num_subnets; n++) {
+    auto& connections = subnet_connections[n];
+    if (!subnets[n] && !connections.empty()) {
+      net->add_connections(connections);
+      ranges.push_back({first, connections.size()});
+      range_subnets.push_back(n);
+      first += connections.size();
+    }
   }
 
-  auto& connections = net->get_connections();
-  // sort composite net connections by the set index which is now the subnet set number
-  std::sort(connections.begin(),connections.end(),[](const Connection& a, const Connection& b) { return a.set < b.set; });
+  // Sorting the last range marks the network as sorted, finishing it
+  // (the concurrent network also merges the ranges then).  So if every
+  // subnet was sorted before, the last one is sorted again.
+  if (ranges.empty() && first > 0) {
+    ranges.push_back(last_sorted_range);
+  }
 
-  unsigned int first = 0;
-  unsigned int set_size = 0;
-  unsigned int prev_set = 0;
-  for (auto i=0u; i<connections.size(); i++) {
-    auto& conn = connections[i];
-
-    if (conn.set != prev_set || i == connections.size()-1) {
-      if (i == connections.size()-1) { set_size++; }
-      if(set_size > 0) {
-        net->sort_connections(first,set_size);
+  // Sort each subnet's range on its own.  Sorting the last range marks
+  // the network as sorted, so it must be sorted last, on this thread,
+  // once the others are done.
+  if (!ranges.empty()) {
+    parallel_for(ranges.size()-1, [&](size_t begin, size_t end) {
+      for (auto r=begin; r<end; r++) {
+        net->sort_connections(ranges[r].first, ranges[r].second);
       }
-      prev_set =conn.set;
-      first = i;
-      set_size = 0;
+    });
+    net->sort_connections(ranges.back().first, ranges.back().second);
+  }
+
+  // Read back the sorted order of the new subnets, to keep them for the next build
+  if (first > first_new) {
+    std::vector<unsigned int> owner(first - first_new);
+    for (auto r=0u; r<range_subnets.size(); r++) {
+      std::fill(owner.begin() + (ranges[r].first - first_new),
+                owner.begin() + (ranges[r].first - first_new + ranges[r].second),
+                r);
     }
 
-    set_size++;
+    std::vector<Subnet> sorted(range_subnets.size());
+    for (auto r=0u; r<range_subnets.size(); r++) {
+      sorted[r].reserve(ranges[r].second);
+    }
+    for (auto i=0u; i<net->num_connections(); i++) {
+      auto added = net->added_index(i);
+      if (added < first_new) {
+        continue;
+      }
+      auto r = owner[added - first_new];
+      auto conn = new_subnets[range_subnets[r]][added - ranges[r].first];
+      conn.set = net->get_connection(i).set;
+      sorted[r].push_back(conn);
+    }
+    for (auto r=0u; r<range_subnets.size(); r++) {
+      new_subnets[range_subnets[r]] = std::move(sorted[r]);
+    }
   }
 
+  // keep the subnets of this build only
+  std::unordered_map<unsigned long, std::shared_ptr<const Subnet> > next;
+  for (auto n=0u; n<num_subnets; n++) {
+    if (!next.count(keys[n])) {
+      next[keys[n]] = subnets[n] ? subnets[n] : std::make_shared<const Subnet>(std::move(new_subnets[n]));
+    }
+  }
+  compiled.swap(next);
+
   return net;
 }
+
+/// Builds a single network holding a subnet for each genome
+/**
+   See CompositeNetBuilder, of which this makes a single build.
+ */
+template<typename NetType>
+std::unique_ptr<NeuralNet> BuildCompositeNet(const std::vector<Genome*>& genomes, bool hetero_inputs,
+                                             ThreadPool* pool) {
+  return CompositeNetBuilder<NetType>().build(genomes, hetero_inputs, pool);
+}
+
+template<typename NetType>
+std::unique_ptr<NeuralNet> BuildCompositeNet(const std::vector<Genome*>& genomes, bool hetero_inputs) {
+  return BuildCompositeNet<NetType>(genomes, hetero_inputs, nullptr);
+}
@@ -22,9 +22,12 @@ public:
   void set_fitness_value(double fitness) { organism->fitness = fitness; }
   bool has_inputs() { return inputs.size() ? true : false; }
   void clear() { inputs.clear(); }
-  std::vector<_float_> evaluate() {
+  /// Evaluates the network on the requested inputs, reusing the storage of outputs
+  void evaluate(std::vector<_float_>& outputs) {
     assert(has_inputs());
-    return organism->network()->evaluate(inputs);
+    auto net = organism->network();
+    outputs.resize(net->num_outputs());
+    net->evaluate(inputs, outputs);
   }
 
   Organism* organism; // non-owning
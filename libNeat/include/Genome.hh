@@ -3,7 +3,6 @@
 #include <ostream>
 #include <set>
 #include <unordered_set>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <memory>
@@ -18,17 +17,21 @@
 
 struct NodeGene;
 struct ConnectionGene;
+template<typename NetType>
+class CompositeNetBuilder;
 
 class Genome : public uses_random_numbers,
                public requires<Probabilities> {
 
   template<typename NetType>
-  friend std::unique_ptr<NeuralNet> BuildCompositeNet(const std::vector<Genome*>& genomes, bool hetero_inputs);
+  friend class CompositeNetBuilder;
 
 
 public:
 
   Genome();
+  Genome(const Genome&);
+  Genome(Genome&&) = default;
   static Genome ConnectedSeed(int num_inputs, int num_outputs);
 
   template<typename NetType>
@@ -38,13 +41,34 @@ public:
     return output;
   }
 
+  /// Network with the structure of net, and the weights of this genome
+  /**
+     net must have been made by MakeNet from a genome with the same
+       StructuralHash, such as a parent differing only in its weights.
+       net is copied, with its state reset and its weights overwritten,
+       skipping the analysis and sorting of MakeNet.
+
+     Returns null if the nodes or connections of net do not match the
+       genes of this genome, so that the caller can fall back to MakeNet.
+   */
+  std::unique_ptr<NeuralNet> MakeNetLike(const NeuralNet& net) const;
+
   Genome& operator=(const Genome&);
+  Genome& operator=(Genome&&) = default;
   Genome& AddNode(NodeType type);
   Genome& AddConnection(unsigned long origin, unsigned long dest,
                         bool status, double weight);
   Genome& RandomizeWeights();
   Genome  MateWith(const Genome& father);
   Genome  MateWith(Genome* father);
+
+  /// Crossover drawing random numbers from gen rather than this genome's generator
+  /**
+     The child uses gen as its generator.  Since the parents are left
+       untouched, children may be made from the same parents on several
+       threads at once, each with its own generator.
+   */
+  Genome  MateWith(const Genome& father, const std::shared_ptr<RNG>& gen) const;
   void    Mutate();
   void    MutateConnection();
   void    MutateNode();
@@ -56,11 +80,31 @@ public:
   Genome  GeneticAncestry() const;
   void    PrintInnovations() const;
   size_t  Size() const { return connection_genes.size(); }
+  /// Connection genes, in the order they were added
+  const std::vector<ConnectionGene>& ConnectionGenes() const { return connection_genes; }
   size_t  NumInputs () const { return num_inputs;  }
   size_t  NumOutputs() const { return num_outputs; }
 
+  /// Approximate number of bytes used by the genome, including its heap storage
+  /**
+     The node table may be shared with other genomes, and is divided
+       evenly between all genomes sharing it.  Summing over a population
+       thus approximates the memory of the whole population.
+   */
+  size_t  MemoryUsage() const;
+
   bool IsStructurallyEqual(const Genome& other) const;
 
+  /// Fingerprint of everything deciding the network made, except the weights
+  /**
+     Hashes the node innovations and types, in order, and the endpoints
+       of the enabled connection genes, in order.  Genomes with equal
+       fingerprints make networks that differ only in their weights,
+       the weight of the k-th enabled gene going to the same connection
+       in each.
+   */
+  unsigned long StructuralHash() const;
+
   friend std::ostream& operator<<(std::ostream&, const Genome& genome);
 
   void AssertNoDuplicateConnections() const;
@@ -68,6 +112,36 @@ public:
   void AssertNoConnectionsToInput() const;
 
 private:
+  /// Node genes, with (innovation, index) pairs sorted by innovation.
+  /**
+     Genomes are copied far more often than their nodes change, so
+       copies share one table.  A genome copies the table before its
+       first change to it, if any other genome shares it.  Since the
+       table is shared, the lookup keeps a copy of each innovation,
+       trading memory for fewer cache misses while searching.
+   */
+  struct NodeTable {
+    std::vector<NodeGene> genes;
+    std::vector<std::pair<unsigned long,unsigned int> > lookup;
+  };
+
+  const std::vector<NodeGene>& NodeGenes() const;
+  NodeTable& MutableNodes();
+  bool HasNode(unsigned long innovation) const;
+  /// Index of the node with the given innovation, which must exist
+  unsigned int NodeIndex(unsigned long innovation) const;
+
+  /// Replays the connection genes, in order, into a new checker
+  ReachabilityChecker BuildReachability(bool enabled_only) const;
+  /// Reachability through all genes, built first if needed
+  const ReachabilityChecker& Reachability();
+  /// Reachability through the enabled genes
+  /**
+     Returns the checker held by the genome if there is one, or else a
+       newly built one, leaving the genome unchanged.
+   */
+  std::shared_ptr<const ReachabilityChecker> EnabledReachability() const;
+
   void MakeNet(NeuralNet& net) const;
 
   const NodeGene* GetNodeByN(unsigned int i) const;
@@ -75,8 +149,6 @@ private:
   const ConnectionGene* GetConnByN(unsigned int i) const;
   const ConnectionGene* GetConnByInnovation(unsigned long innovation) const;
 
-  NodeGene* GetNodeByN(unsigned int i);
-  NodeGene* GetNodeByInnovation(unsigned long innovation);
   ConnectionGene* GetConnByN(unsigned int i);
   ConnectionGene* GetConnByInnovation(unsigned long innovation);
 
@@ -114,12 +186,30 @@ private:
   size_t num_inputs;
   size_t num_outputs;
 
-  std::vector<NodeGene> node_genes;
-  std::unordered_map<unsigned long,unsigned int> node_lookup;
+  // Null if the genome has no nodes.
+  std::shared_ptr<NodeTable> nodes;
 
+  // Connection genes are kept in the order they were added, since that
+  // order decides which connections of a loop are recurrent in the
+  // network.  connection_lookup holds their indices in order of
+  // innovation, so that two genomes can be compared by a single merge.
   std::vector<ConnectionGene> connection_genes;
-  std::unordered_map<unsigned long,unsigned int> connection_lookup;
-  std::set<std::pair<unsigned long, unsigned long> > connections_existing;
+  std::vector<unsigned int> connection_lookup;
+
+  // Only needed when adding connections, so not copied with the genome.
+  // Either holds the endpoints of every connection gene, or is empty
+  // and rebuilt before the next connection is added.
+  std::vector<std::pair<unsigned long, unsigned long> > connections_existing;
+
+  // Reachability between nodes by index, or null if not built since the
+  // last change that could not be applied in place.  reachability holds
+  // every connection gene, and chooses new connections.
+  // enabled_reachability holds only the enabled genes, in order, and
+  // chooses the nodes kept in the network and which of their connections
+  // are recurrent.  Like the node table, each is shared between copies,
+  // and copied before its first change.
+  std::shared_ptr<ReachabilityChecker> reachability;
+  std::shared_ptr<ReachabilityChecker> enabled_reachability;
 
   // innovation record keeping
   unsigned long last_conn_innov;
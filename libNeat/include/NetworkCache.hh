@@ -0,0 +1,133 @@
+#pragma once
+#include "NeuralNet.hh"
+#include "Genome.hh"
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+/// Sorted networks by genome structure, reused for every genome of that structure
+/**
+   Sorting the connections of a network only depends on the structure
+     of its genome.  The first network made for each
+     Genome::StructuralHash is sorted, and a copy kept.  Later genomes of
+     the same structure get a copy of it with their own weights, through
+     Genome::MakeNetLike.  In a population, most organisms share their
+     structure with many others, so few networks are sorted.
+
+   Instance() is shared by the whole process, so that every population
+     converting genomes to NetType uses it.  Networks are made without
+     holding the lock, so any number of threads may call MakeNet at
+     once.  At most Capacity() structures are kept, dropping the least
+     recently used.
+ */
+template<typename NetType>
+class NetworkCache {
+public:
+  explicit NetworkCache(size_t capacity=1024) : capacity(capacity) { ; }
+
+  NetworkCache(const NetworkCache&) = delete;
+  NetworkCache& operator=(const NetworkCache&) = delete;
+
+  /// The cache shared by the whole process
+  static NetworkCache& Instance() {
+    static NetworkCache cache;
+    return cache;
+  }
+
+  /// Network of the genome, sorted
+  std::unique_ptr<NeuralNet> MakeNet(const Genome& genome);
+
+  /// Number of structures kept
+  size_t Size() const;
+  size_t Capacity() const;
+  /// Sets the number of structures kept, 0 keeping none
+  void SetCapacity(size_t capacity);
+  void Clear();
+
+private:
+  // Least recently used last.
+  typedef std::list<std::pair<unsigned long, std::shared_ptr<const NeuralNet> > > Entries;
+
+  mutable std::mutex mutex;
+  size_t capacity;
+  Entries entries;
+  std::unordered_map<unsigned long, typename Entries::iterator> lookup;
+
+  // Drops the least recently used structures beyond the capacity.  Must hold the lock.
+  void Trim();
+};
+
+template<typename NetType>
+std::unique_ptr<NeuralNet> NetworkCache<NetType>::MakeNet(const Genome& genome) {
+  auto key = genome.StructuralHash();
+
+  std::shared_ptr<const NeuralNet> prototype;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = lookup.find(key);
+    if (found != lookup.end()) {
+      entries.splice(entries.begin(), entries, found->second);
+      prototype = found->second->second;
+    }
+  }
+  // The prototype is never changed, and is kept alive here even if dropped meanwhile.
+  // A genome whose hash collides with the prototype's is made from scratch.
+  if (prototype) {
+    auto net = genome.MakeNetLike(*prototype);
+    if (net) {
+      return net;
+    }
+  }
+
+  auto net = genome.MakeNet<NetType>();
+  net->sort_connections();
+  std::shared_ptr<const NeuralNet> copy = net->clone();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!lookup.count(key)) {
+      entries.emplace_front(key, std::move(copy));
+      lookup[key] = entries.begin();
+      Trim();
+    }
+  }
+  return net;
+}
+
+template<typename NetType>
+size_t NetworkCache<NetType>::Size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+template<typename NetType>
+size_t NetworkCache<NetType>::Capacity() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return capacity;
+}
+
+template<typename NetType>
+void NetworkCache<NetType>::SetCapacity(size_t capacity) {
+  std::lock_guard<std::mutex> lock(mutex);
+  this->capacity = capacity;
+  Trim();
+}
+
+template<typename NetType>
+void NetworkCache<NetType>::Clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+  lookup.clear();
+}
+
+template<typename NetType>
+void NetworkCache<NetType>::Trim() {
+  while (entries.size() > capacity) {
+    lookup.erase(entries.back().first);
+    entries.pop_back();
+  }
+}
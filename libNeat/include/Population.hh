@@ -3,6 +3,7 @@
 #include "NeuralNet.hh"
 #include "PopulationHelpers.hh"
 #include "FitnessEvaluator.hh"
+#include "ThreadPool.hh"
 
 #include <vector>
 #include <limits>
@@ -106,7 +107,45 @@ public:
     this->heterogeneous_inputs = heterogeneous_inputs;
     this->use_composite_net = true;
   }
-  void DisableCompositeNet() { use_composite_net = true; }
+  void DisableCompositeNet() { use_composite_net = false; }
+
+  /// Evaluate all organisms together through a PopulationBatchNet.
+  /**
+     Each organism keeps its own inputs and outputs.  An organism that
+       provides no inputs for a step keeps its state, as it would when
+       evaluated on its own.  The recurrent state lives in the batch, so
+       the organisms' own networks are left untouched.
+
+     Every network uses the logistic activation of PopulationBatchNet.
+       The activation policy of the network type, and sigmoids registered
+       on the organisms' networks, are ignored.
+   */
+  void EnableBatchNet() { use_batch_net = true; }
+  void DisableBatchNet() { use_batch_net = false; }
+
+  /// Evaluate and reproduce organisms on several threads.
+  /**
+     Evaluation is threaded when using a FitnessEvaluator factory,
+       without a composite or batch net.  The evaluators are stepped and
+       their networks evaluated in parallel, so each evaluator must only
+       touch its own state.  Evaluators are still created in order on
+       the calling thread, and each organism is evaluated by its own
+       evaluator, so the fitness values do not depend on the number of
+       threads.
+
+     Reproduction chooses the parents of each child, and a seed for its
+       random numbers, in order on the population's generator.
+       Crossover and mutation then run in parallel, each child drawing
+       from its own RNG_MersenneTwister.  The next generation thus
+       depends only on the state of the population's generator, and
+       not on the number of threads.
+
+     0 uses every hardware thread, and 1 does everything on the calling
+       thread.  The setting is passed on to the populations made by
+       Reproduce.
+   */
+  void SetNumThreads(unsigned int num_threads);
+  unsigned int NumThreads() const { return thread_pool ? thread_pool->num_threads() : 1; }
 
   inline auto GetPopulation() {
     std::vector<Genome*> genomes;
@@ -121,15 +160,37 @@ public:
 private:
   void EvaluateSequential(std::function<std::unique_ptr<FitnessEvaluator>(void)> evaluator_factory);
   void EvaluateComposite(std::function<std::unique_ptr<FitnessEvaluator>(void)> evaluator_factory);
+  void EvaluateBatched(std::function<std::unique_ptr<FitnessEvaluator>(void)> evaluator_factory);
 
   std::vector<Species> MakeNextGenerationSpecies();
-  std::vector<Genome> MakeNextGenerationGenomes();
+  /// Makes the genomes of the next generation
+  /**
+     nets receives a network for each child keeping the structure of its
+       mother, if she has a network, or null for the others.
+   */
+  std::vector<Genome> MakeNextGenerationGenomes(std::vector<std::unique_ptr<NeuralNet> >& nets);
   void DistributeChildrenByRank(std::vector<unsigned int>&) const;
   void DistributeNurseryChildren(std::vector<unsigned int>&) const;
 
 
+  /// Calls func(begin, end) over [0, n), on the thread pool if there is one.
+  template<typename Func>
+  void ParallelFor(size_t n, Func&& func) {
+    if (thread_pool) {
+      thread_pool->parallel_for(n, 0, std::forward<Func>(func));
+    } else {
+      func(0, n);
+    }
+  }
+
+  /// Adds an organism for each genome, to the first species close enough
+  /**
+     If nets is given, non-null networks are moved into the organisms
+       of the matching genomes.
+   */
   void Speciate(std::vector<Species>& species,
-                const std::vector<Genome>& genomes);
+                const std::vector<Genome>& genomes,
+                std::vector<std::unique_ptr<NeuralNet> >* nets=nullptr);
   void CalculateAdjustedFitness();
 
   std::vector<Species> species;
@@ -138,4 +199,7 @@ private:
   // composite net options
   bool use_composite_net;
   bool heterogeneous_inputs;
+  bool use_batch_net = false;
+
+  std::shared_ptr<ThreadPool> thread_pool;
 };
@@ -1,18 +1,24 @@
 #pragma once
 #include "CompositeNet.hh"
+#include "NetworkCache.hh"
 
 struct GenomeConverter {
   virtual std::unique_ptr<NeuralNet> convert(const Genome&) = 0;
-  virtual std::unique_ptr<NeuralNet> convert(const std::vector<Genome*>&,bool hetero_inputs=true) = 0;
+  virtual std::unique_ptr<NeuralNet> convert(const std::vector<Genome*>&,bool hetero_inputs=true,
+                                             ThreadPool* pool=nullptr) = 0;
 };
 template<typename NetType>
 struct GenomeConverter_Impl : GenomeConverter {
   virtual std::unique_ptr<NeuralNet> convert(const Genome& genome) {
-    return genome.MakeNet<NetType>();
+    return NetworkCache<NetType>::Instance().MakeNet(genome);
   }
-  virtual std::unique_ptr<NeuralNet> convert(const std::vector<Genome*>& genomes, bool hetero_inputs=true) {
-    return BuildCompositeNet<NetType>(genomes,hetero_inputs);
+  virtual std::unique_ptr<NeuralNet> convert(const std::vector<Genome*>& genomes, bool hetero_inputs=true,
+                                             ThreadPool* pool=nullptr) {
+    return composite_builder.build(genomes,hetero_inputs,pool);
   }
+private:
+  // Keeps the subnets of one generation for the next.
+  CompositeNetBuilder<NetType> composite_builder;
 };
 
 struct Organism {
@@ -21,10 +27,17 @@ struct Organism {
       adj_fitness(std::numeric_limits<double>::quiet_NaN()),
       genome(gen), net(nullptr), converter(converter) { ; }
 
+  Organism(const Genome& gen, std::shared_ptr<GenomeConverter> converter,
+           std::unique_ptr<NeuralNet>&& net)
+    : fitness(std::numeric_limits<double>::quiet_NaN()),
+      adj_fitness(std::numeric_limits<double>::quiet_NaN()),
+      genome(gen), net(std::move(net)), converter(converter) { ; }
+
   Organism(const Genome& gen, std::unique_ptr<NeuralNet>&& net)
     : fitness(std::numeric_limits<double>::quiet_NaN()),
       adj_fitness(std::numeric_limits<double>::quiet_NaN()),
       genome(gen) , net(std::move(net)), converter(nullptr) { ; }
+  // A copy of the network shares its connections, and only copies node values.
   Organism(const Organism& org)
     : fitness(org.fitness), adj_fitness(org.adj_fitness),
       genome(org.genome), net(org.net ? org.net->clone() : nullptr),
@@ -42,6 +55,8 @@ struct Organism {
     net = converter->convert(genome);
     return net.get();
   }
+  /// The network, or null if it has not been made yet
+  const NeuralNet* built_network() const { return net.get(); }
   double fitness;
   double adj_fitness;
   Genome genome;
@@ -1,7 +1,8 @@
 #pragma once
 
 #include <cassert>
-#include <cstring>
+#include <cstddef>
+#include <cstdint>
 #include <utility>
 #include <vector>
 
@@ -20,6 +21,23 @@ public:
    */
   ReachabilityChecker(size_t num_nodes, size_t num_inputs = 0);
 
+  /// Adds a node, without any connections
+  /*
+    The new node is at index num_nodes, and is not an input node.
+    The result is the same as if the node had been present from the start.
+   */
+  void AddNode();
+
+  size_t NumNodes() const { return num_nodes; }
+
+  /// Approximate number of bytes used, including heap storage
+  size_t MemoryUsage() const {
+    return (sizeof(ReachabilityChecker) +
+            has_normal.memory_usage() + has_recurrent.memory_usage() +
+            reachable_normal.memory_usage() + reachable_either.memory_usage() +
+            normal_candidates.memory_usage() + recurrent_candidates.memory_usage());
+  }
+
   /// Adds a connection
   /*
     origin is the index of the origin-node
@@ -35,103 +53,166 @@ public:
 
   /// Checks whether a given connection has been defined
   bool HasConnection(size_t origin, size_t destination) const {
-    return at(origin,destination).has_any_connection;
+    return (has_normal.get(destination,origin) ||
+            has_recurrent.get(destination,origin));
   }
 
   /// Checks whether a given connection has been defined, and is normal
   bool HasNormalConnection(size_t origin, size_t destination) const {
-    return at(origin,destination).has_normal_connection;
+    return has_normal.get(destination,origin);
   }
 
   /// Checks whether a given connection has been defined, and is recurrent
   bool HasRecurrentConnection(size_t origin, size_t destination) const {
-    return at(origin,destination).has_recurrent_connection;
+    return has_recurrent.get(destination,origin);
   }
 
   /// Return true if a path from origin to destination exists using only normal connections.
   bool IsReachableNormal(size_t origin, size_t destination) const {
-    return at(origin,destination).reachable_normal;
+    return reachable_normal.get(origin,destination);
   }
 
   /// Return true if a path from origin to destination exists using any connections.
   bool IsReachableEither(size_t origin, size_t destination) const {
-    return at(origin,destination).reachable_either;
+    return reachable_either.get(origin,destination);
   }
 
   /// Returns true if no additional connections can be added.
   bool IsFullyConnected() const {
-    return (num_possible_normal_connections == 0 &&
-            num_possible_recurrent_connections == 0);
+    return (normal_candidates.total() == 0 &&
+            recurrent_candidates.total() == 0);
   }
 
   /// Returns the number of different normal connections that could be added.
   size_t NumPossibleNormalConnections() const {
-    return num_possible_normal_connections;
+    return normal_candidates.total();
   }
 
   /// Returns the number of different recurrent connections that could be added.
   size_t NumPossibleRecurrentConnections() const {
-    return num_possible_recurrent_connections;
+    return recurrent_candidates.total();
   }
 
   /// Returns a randomly selected normal connection to add.
   /**
      If no such connection exists, returns (-1,-1).
+
+     Tries a few random pairs if they are likely to be valid.
+       Otherwise, picks a destination weighted by its number of valid
+       origins, then one of those origins, in O(N/64 + log N).
    */
-  std::pair<int,int> RandomNormalConnection(RNG& rng);
+  std::pair<int,int> RandomNormalConnection(RNG& rng) const;
 
   /// Returns a randomly selected recurrent connection to add.
   /**
      If no such connection exists, returns (-1,-1).
    */
-  std::pair<int,int> RandomRecurrentConnection(RNG& rng);
+  std::pair<int,int> RandomRecurrentConnection(RNG& rng) const;
 
 
 
 
 private:
-  // Bit-packed, sizeof(MatrixElement)==1
-  struct MatrixElement {
-    MatrixElement() {
-      memset(this, 0, sizeof(MatrixElement));
+  /// Square matrix of bits, stored as rows of 64-bit words
+  class BitMatrix {
+  public:
+    BitMatrix(size_t num_nodes)
+      : words_per_row(num_words(num_nodes)), num_rows(num_nodes),
+        words(num_rows*words_per_row, 0) { }
+
+    bool get(size_t i, size_t j) const {
+      assert(i < num_rows);
+      assert(j < num_rows);
+      return (words[i*words_per_row + j/64] >> (j%64)) & 1;
     }
 
-    bool has_any_connection : 1;
-    bool has_normal_connection : 1;
-    bool has_recurrent_connection : 1;
-    bool reachable_normal : 1;
-    bool reachable_either : 1;
+    void set(size_t i, size_t j) {
+      assert(i < num_rows);
+      assert(j < num_rows);
+      words[i*words_per_row + j/64] |= uint64_t(1) << (j%64);
+    }
+
+    uint64_t* row(size_t i) { return &words[i*words_per_row]; }
+    const uint64_t* row(size_t i) const { return &words[i*words_per_row]; }
+
+    size_t row_words() const { return words_per_row; }
+
+    /// Appends an empty row and column
+    void add_node();
+
+    size_t memory_usage() const { return words.capacity()*sizeof(uint64_t); }
+
+  private:
+    static size_t num_words(size_t num_nodes) { return (num_nodes + 63)/64; }
+
+    size_t words_per_row;
+    size_t num_rows;
+    std::vector<uint64_t> words;
   };
 
   size_t num_nodes;
   size_t num_inputs;
-  size_t num_possible_normal_connections;
-  size_t num_possible_recurrent_connections;
+  /// Counts per index, with a Fenwick tree of their prefix sums
+  class CountIndex {
+  public:
+    CountIndex() : sum(0) { }
 
-  std::vector<MatrixElement> mat;
+    size_t total() const { return sum; }
 
-  MatrixElement& at(size_t i, size_t j) {
-    assert(i < num_nodes);
-    assert(j < num_nodes);
-    return mat[i*num_nodes + j];
-  }
+    void push_back(size_t count);
+    void add(size_t i, long delta);
 
-  const MatrixElement& at(size_t i, size_t j) const {
-    assert(i < num_nodes);
-    assert(j < num_nodes);
-    return mat[i*num_nodes + j];
-  }
+    /// Adds delta to the count at each index in [begin, size)
+    void add_from(size_t begin, long delta);
+
+    /// Index holding the k-th unit counted, with k then made relative to it
+    size_t find(size_t& k) const;
+
+    size_t memory_usage() const {
+      return (counts.capacity() + tree.capacity())*sizeof(size_t);
+    }
+
+  private:
+    void rebuild();
+
+    size_t sum;
+    std::vector<size_t> counts;
+    // tree[i-1] holds the sum of counts[i-lowbit(i), i)
+    std::vector<size_t> tree;
+  };
+
+  // Connections are stored by destination, so that a row holds every
+  // origin connected to one destination.
+  BitMatrix has_normal;
+  BitMatrix has_recurrent;
+  BitMatrix reachable_normal;
+  BitMatrix reachable_either;
+
+  // Number of origins that could be connected to each destination.  A
+  // connection from j to i is recurrent exactly when j is reachable
+  // from i, so each count only changes with its own row of
+  // reachable_normal.
+  CountIndex normal_candidates;
+  CountIndex recurrent_candidates;
+
+  /// Marks every path through a new connection as reachable
+  /**
+     If update_candidates, moves each node newly reachable from a
+       destination node from its normal to its recurrent candidates.
+   */
+  void fill_reachable(BitMatrix& reachable, size_t origin, size_t destination,
+                      bool update_candidates);
 
-  void fill_normal_reachable(size_t origin, size_t destination);
-  void fill_either_reachable(size_t origin, size_t destination);
+  /// The k-th origin, in order, that could be connected to destination
+  size_t select_origin(size_t destination, size_t k, bool recurrent) const;
 
-  bool could_add_normal(size_t origin, size_t destination) {
-    return (!at(origin,destination).has_any_connection &&
-            !at(destination, origin).reachable_normal);
+  bool could_add_normal(size_t origin, size_t destination) const {
+    return (!HasConnection(origin,destination) &&
+            !reachable_normal.get(destination, origin));
   }
 
-  bool could_add_recurrent(size_t origin, size_t destination) {
-    return (!at(origin,destination).has_any_connection &&
-            at(destination, origin).reachable_normal);
+  bool could_add_recurrent(size_t origin, size_t destination) const {
+    return (!HasConnection(origin,destination) &&
+            reachable_normal.get(destination, origin));
   }
 };
@@ -13,6 +13,12 @@ protected:
   std::shared_ptr<T> required_;
 };
 
+/// How adjusted fitness counts the genetically similar organisms of a species
+enum class FitnessSharing {
+  Exact,   // compare each organism against every other in its species
+  Sampled, // estimate the count from a random sample of the species
+};
+
 struct Probabilities {
 
   size_t population_size = 100;
@@ -50,4 +56,7 @@ struct Probabilities {
   size_t number_of_children_given_in_nursery = 100;
   float species_survival_percentile = 0.3;
 
+  FitnessSharing fitness_sharing = FitnessSharing::Exact;
+  size_t fitness_sharing_samples = 32; // per organism, if sampled
+
 };
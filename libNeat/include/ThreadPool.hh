@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed set of worker threads, running parallel loops with work stealing.
+/**
+   parallel_for splits a range of indices into chunks, and gives each
+     thread, including the calling thread, a contiguous share of them.
+     A thread takes chunks from the front of its own share, and once it
+     runs out, steals chunks from the back of the share of another
+     thread.  Uneven costs per index are therefore balanced without a
+     single shared queue.
+
+   Only one loop runs at a time.  A loop started from within the body
+     of another loop is run serially on the calling thread.
+ */
+class ThreadPool {
+public:
+  /// Constructs a pool using num_threads threads in total, including the caller
+  /**
+     If num_threads is 0, uses one thread per hardware thread.
+   */
+  explicit ThreadPool(unsigned int num_threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /// Number of threads used by parallel_for, including the caller
+  unsigned int num_threads() const { return workers.size() + 1; }
+
+  /// Calls func(begin, end) on consecutive ranges covering [0, n).
+  /**
+     Each range holds at most chunk_size indices.  If chunk_size is 0,
+       a size is chosen giving each thread several chunks to balance.
+       Returns once every range has been processed.  If func throws,
+       the remaining ranges are skipped, and the first exception is
+       rethrown on the calling thread.
+   */
+  template<typename Func>
+  void parallel_for(size_t n, size_t chunk_size, Func&& func) {
+    run(n, chunk_size, std::function<void(size_t, size_t)>(std::forward<Func>(func)));
+  }
+
+private:
+  struct Share {
+    std::mutex mutex;
+    size_t front = 0;
+    size_t back = 0;
+  };
+
+  void run(size_t n, size_t chunk_size, std::function<void(size_t, size_t)> func);
+  void worker_loop(unsigned int index);
+  void work(unsigned int index);
+  bool take_chunk(unsigned int index, size_t& chunk);
+
+  std::vector<std::thread> workers;
+  std::vector<std::unique_ptr<Share> > shares;
+
+  // Serializes calls to parallel_for.
+  std::mutex run_mutex;
+
+  // State of the current loop, guarded by mutex.
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  unsigned long generation = 0;
+  unsigned int busy_workers = 0;
+  bool stopping = false;
+  std::exception_ptr error;
+  std::atomic<bool> failed{false};
+
+  // Set before the workers are woken, read-only while they run.
+  const std::function<void(size_t, size_t)>* task = nullptr;
+  size_t task_size = 0;
+  size_t task_chunk_size = 0;
+};
@@ -1,34 +1,72 @@
 #include "Genome.hh"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <iostream>
 #include <map>
 #include <sstream>
 
+namespace {
+  /// First position in lookup whose gene has an innovation not less than innovation
+  template<typename Lookup, typename Gene>
+  auto lower_bound_innovation(Lookup& lookup, const std::vector<Gene>& genes,
+                              unsigned long innovation) {
+    return std::lower_bound(lookup.begin(), lookup.end(), innovation,
+                            [&genes](unsigned int i, unsigned long innovation) {
+                              return genes[i].innovation < innovation;
+                            });
+  }
+
+  /// The object held by ptr, copied first if any other pointer shares it
+  template<typename T>
+  T& unshare(std::shared_ptr<T>& ptr) {
+    if(ptr.use_count() > 1) {
+      ptr = std::make_shared<T>(*ptr);
+    } else {
+      // Pointers that shared the object may have released it on
+      // another thread.  Their reads of it must happen before our writes.
+      std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *ptr;
+  }
+
+  /// Mixes value into a running hash
+  unsigned long hash_combine(unsigned long hash, unsigned long value) {
+    // finalizer of splitmix64, so that every bit of value affects every bit of the result
+    hash ^= value + 0x9e3779b97f4a7c15UL + (hash << 6) + (hash >> 2);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9UL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebUL;
+    return hash ^ (hash >> 31);
+  }
+}
+
 Genome::Genome() : num_inputs(0), num_outputs(0),
                    last_conn_innov(0), last_node_innov(0) { ; }
 
+Genome::Genome(const Genome& other)
+  : uses_random_numbers(other), requires<Probabilities>(other),
+    num_inputs(other.num_inputs), num_outputs(other.num_outputs),
+    nodes(other.nodes),
+    connection_genes(other.connection_genes),
+    connection_lookup(other.connection_lookup),
+    reachability(other.reachability),
+    enabled_reachability(other.enabled_reachability),
+    last_conn_innov(other.last_conn_innov), last_node_innov(other.last_node_innov) { ; }
+
 void Genome::MakeNet(NeuralNet& net) const {
   AssertInputNodesFirst();
   AssertNoConnectionsToInput();
 
-  // populate reachability checker
-  ReachabilityChecker checker(node_genes.size(),num_inputs);
-  for(auto& gene : connection_genes) {
-    if (gene.enabled) {
-      int i = node_lookup.at(gene.origin);
-      int j = node_lookup.at(gene.dest);
-      checker.AddConnection(i,j);
-    }
-  }
+  auto& node_genes = NodeGenes();
+  auto checker = EnabledReachability();
 
   // use reachability checker to determine if a node is unconnected
   std::unordered_set<unsigned int> exclusions;
   for (auto n=0u; n<node_genes.size(); n++) {
     // if the node is not reachable from either inputs
     // or outputs, add to the exclusion list
-    if (!ConnectivityCheck(n,checker)) {
+    if (!ConnectivityCheck(n,*checker)) {
       exclusions.insert(n);
     }
   }
@@ -39,18 +77,64 @@ void Genome::MakeNet(NeuralNet& net) const {
   for (auto& gene: node_genes) {
     net.add_node(gene.type);
   }
+  // The checker already knows which connections close a loop
+  std::vector<Connection> connections;
+  connections.reserve(connection_genes.size());
   for(auto& gene : connection_genes) {
     if (gene.enabled) {
-      int i = node_lookup.at(gene.origin);
-      int j = node_lookup.at(gene.dest);
+      int i = NodeIndex(gene.origin);
+      int j = NodeIndex(gene.dest);
       if(exclusions.count(i) == 0 &&
          exclusions.count(j) == 0) {
-        net.add_connection(i,j,gene.weight);
+        auto type = checker->HasRecurrentConnection(i,j) ? ConnectionType::Recurrent : ConnectionType::Normal;
+        connections.emplace_back(i,j,type,gene.weight,std::numeric_limits<unsigned int>::max());
       }
     }
   }
+  net.add_connections(connections);
 }
 
+std::unique_ptr<NeuralNet> Genome::MakeNetLike(const NeuralNet& net) const {
+  auto output = net.clone();
+
+  auto& node_genes = NodeGenes();
+  if (output->num_nodes() != node_genes.size()) {
+    return nullptr;
+  }
+  for (auto n=0u; n<node_genes.size(); n++) {
+    if (output->get_node_type(n) != node_genes[n].type) {
+      return nullptr;
+    }
+  }
+  output->reset_state();
+
+  // MakeNet added the enabled genes in order, skipping those touching an
+  // excluded node.  Each pair of nodes has a single gene, so the genes
+  // kept are found by their endpoints.
+  auto num_connections = output->num_connections();
+  std::vector<std::pair<unsigned int, unsigned int> > endpoints(num_connections);
+  for (auto i=0u; i<num_connections; i++) {
+    auto conn = output->get_connection(i);
+    endpoints[output->added_index(i)] = {conn.origin, conn.dest};
+  }
+
+  std::vector<_float_> weights(num_connections);
+  auto k = 0u;
+  for (auto& gene : connection_genes) {
+    if (gene.enabled && k < num_connections &&
+        endpoints[k] == std::make_pair(NodeIndex(gene.origin), NodeIndex(gene.dest))) {
+      weights[k++] = gene.weight;
+    }
+  }
+  // Structural hashes may collide, so a network of another structure
+  // is refused rather than given weights of 0.
+  if (k != num_connections) {
+    return nullptr;
+  }
+
+  output->set_weights(weights);
+  return output;
+}
 
 Genome Genome::ConnectedSeed(int num_inputs, int num_outputs) {
   Genome output;
@@ -79,11 +163,12 @@ Genome Genome::ConnectedSeed(int num_inputs, int num_outputs) {
 Genome& Genome::operator=(const Genome& rhs) {
   this->num_inputs = rhs.num_inputs;
   this->num_outputs = rhs.num_outputs;
-  this->node_genes = rhs.node_genes;
-  this->node_lookup = rhs.node_lookup;
+  this->nodes = rhs.nodes;
   this->connection_genes = rhs.connection_genes;
   this->connection_lookup = rhs.connection_lookup;
-  this->connections_existing = rhs.connections_existing;
+  this->connections_existing.clear();
+  this->reachability = rhs.reachability;
+  this->enabled_reachability = rhs.enabled_reachability;
   this->last_conn_innov = rhs.last_conn_innov;
   this->last_node_innov = rhs.last_node_innov;
   this->generator = rhs.generator;
@@ -95,27 +180,30 @@ float Genome::GeneticDistance(const Genome& other) const {
   double weight_diffs = 0.0;
   unsigned long nUnshared = 0;
   unsigned long nShared = 0;
-  auto nGenes = std::max(connection_genes.size(),other.connection_genes.size());
 
-  // loop over this genomes genes
-  for (auto& gene : connection_genes) {
-    // sum the absolute weight differences of the shared genes
-    auto other_gene = other.GetConnByInnovation(gene.innovation);
-    if(other_gene) {
-      weight_diffs += std::abs(other_gene->weight - gene.weight);
-      nShared++;
-    }
-    // count the number of unshared genes
-    else {
+  // walk both genomes' genes in order of innovation
+  auto iter = connection_lookup.begin();
+  auto other_iter = other.connection_lookup.begin();
+  while (iter != connection_lookup.end() &&
+         other_iter != other.connection_lookup.end()) {
+    auto& gene = connection_genes[*iter];
+    auto& other_gene = other.connection_genes[*other_iter];
+    if (gene.innovation < other_gene.innovation) {
       nUnshared++;
-    }
-  }
-  // loop over other genomes genes and count the unshared genes
-  for (auto& other_gene : other.connection_genes) {
-    if (connection_lookup.count(other_gene.innovation) == 0) {
+      iter++;
+    } else if (other_gene.innovation < gene.innovation) {
       nUnshared++;
+      other_iter++;
+    } else {
+      // sum the absolute weight differences of the shared genes
+      weight_diffs += std::abs(other_gene.weight - gene.weight);
+      nShared++;
+      iter++;
+      other_iter++;
     }
   }
+  // the remaining genes of either genome are unshared
+  nUnshared += (connection_lookup.end() - iter) + (other.connection_lookup.end() - other_iter);
 
   return
     required()->genetic_distance_structural*nUnshared +
@@ -127,7 +215,7 @@ Genome Genome::GeneticAncestry() const {
   descendant.set_generator(this->get_generator());
   descendant.required(this->required());
   // Add all non-hidden nodes.
-  for(auto& gene : this->node_genes) {
+  for(auto& gene : this->NodeGenes()) {
     if(gene.type == NodeType::Input ||
        gene.type == NodeType::Bias ||
        gene.type == NodeType::Output) {
@@ -144,13 +232,18 @@ Genome Genome::GeneticAncestry() const {
 Genome Genome::MateWith(Genome* father) {
   return MateWith(*father);
 }
-// Generalized genome crossover
 Genome Genome::MateWith(const Genome& father) {
+  return MateWith(father, generator);
+}
+// Generalized genome crossover
+Genome Genome::MateWith(const Genome& father, const std::shared_ptr<RNG>& gen) const {
   // Implicit assumption: Mother must always be the more
   // fit genome. i.e. child = mother(father) such that
   // fitness(mother) > fitness(father)
   auto& mother = *this;
   auto child = this->GeneticAncestry();
+  child.set_generator(gen);
+  auto& rng = *gen;
 
 
   const auto& match          = required()->matching_gene_choose_mother;
@@ -167,22 +260,45 @@ Genome Genome::MateWith(const Genome& father) {
     child.AddConnectionGene(conn_gene);
   };
 
-  for(auto& maternal_gene : mother.connection_genes) {
-    // Find all shared genes, look up by hash
-    if (father.connection_lookup.count(maternal_gene.innovation) > 0) {
+  // Find the genes shared by both parents, with a single merge of
+  // their genes sorted by innovation.  paternal_match holds, for each
+  // of the mother's genes, the index of the father's matching gene.
+  std::vector<int> paternal_match(mother.connection_genes.size(), -1);
+  std::vector<bool> father_gene_shared(father.connection_genes.size(), false);
+  auto mother_iter = mother.connection_lookup.begin();
+  auto father_iter = father.connection_lookup.begin();
+  while (mother_iter != mother.connection_lookup.end() &&
+         father_iter != father.connection_lookup.end()) {
+    auto mother_innov = mother.connection_genes[*mother_iter].innovation;
+    auto father_innov = father.connection_genes[*father_iter].innovation;
+    if (mother_innov < father_innov) {
+      mother_iter++;
+    } else if (father_innov < mother_innov) {
+      father_iter++;
+    } else {
+      paternal_match[*mother_iter] = *father_iter;
+      father_gene_shared[*father_iter] = true;
+      mother_iter++;
+      father_iter++;
+    }
+  }
+
+  for(auto i=0u; i<mother.connection_genes.size(); i++) {
+    auto& maternal_gene = mother.connection_genes[i];
+    if (paternal_match[i] >= 0) {
       // matching genes
-      if (random()<match) {
+      if (rng()<match) {
         // if key doesn't already exist in child,
         // then the maternal_gene gene is inserted
         add_conn_to_child(mother,maternal_gene,child);
       } else {
         // paternal_gene gene is taken
-        auto& paternal_gene = father.connection_genes.at(father.connection_lookup.at(maternal_gene.innovation));
+        auto& paternal_gene = father.connection_genes[paternal_match[i]];
         add_conn_to_child(father,paternal_gene,child);
       }
     } else {
       // non matching gene, randomly insert maternal_gene gene
-      if (random()<single_greater) {
+      if (rng()<single_greater) {
         add_conn_to_child(mother,maternal_gene,child);
       }
     }
@@ -191,15 +307,15 @@ Genome Genome::MateWith(const Genome& father) {
   // Standard NEAT bails out here
   if (single_lesser > 0.0) {
     // allow for merging of structure from less fit parent
-    for(auto& paternal_gene : father.connection_genes) {
-      if(mother.connection_lookup.count(paternal_gene.innovation) == 0 &&
-         random()<single_lesser) {
-        add_conn_to_child(father,paternal_gene,child);
+    for(auto i=0u; i<father.connection_genes.size(); i++) {
+      if(!father_gene_shared[i] &&
+         rng()<single_lesser) {
+        add_conn_to_child(father,father.connection_genes[i],child);
       }
     }
   }
 
-  assert(child.node_genes.size() == child.node_lookup.size());
+  assert(!child.nodes || child.nodes->genes.size() == child.nodes->lookup.size());
   assert(child.connection_genes.size() == child.connection_lookup.size());
   child.AssertNoDuplicateConnections();
 
@@ -217,7 +333,7 @@ Genome& Genome::AddNode(NodeType type) {
   // User-defined nodes, no real innovation number
   // Instead, make something up to ensure unique ids for each.
 
-  unsigned long innovation = node_genes.size();
+  unsigned long innovation = NodeGenes().size();
   switch(type) {
   case NodeType::Bias:
     innovation = Hash(0, last_node_innov);
@@ -237,7 +353,7 @@ Genome& Genome::AddNode(NodeType type) {
 }
 
 Genome& Genome::AddNodeByInnovation(NodeType type, unsigned long innovation) {
-  assert(node_lookup.count(innovation) == 0);
+  assert(!HasNode(innovation));
   NodeGene gene(type, innovation);
   AddNodeGene(gene);
   return *this;
@@ -254,8 +370,8 @@ Genome& Genome::AddConnection(unsigned long origin, unsigned long dest,
   // node_lookup.insert({node_genes[origin].innovation, origin});
   // node_lookup.insert({node_genes[dest].innovation, dest});
 
-  AddConnectionByInnovation(node_genes[origin].innovation,
-                            node_genes[dest].innovation,
+  AddConnectionByInnovation(NodeGenes()[origin].innovation,
+                            NodeGenes()[dest].innovation,
                             status, weight);
   return *this;
 }
@@ -273,10 +389,14 @@ void Genome::AddConnectionByInnovation(unsigned long origin, unsigned long dest,
 }
 
 void Genome::AddNodeGene(NodeGene gene) {
-  if(node_lookup.count(gene.innovation) != 0) {
+  if(HasNode(gene.innovation)) {
     return;
   }
 
+  auto& table = MutableNodes();
+  auto& node_genes = table.genes;
+  auto& node_lookup = table.lookup;
+
   bool needs_resort = IsSensor(gene.type) && (node_genes.size() != num_inputs);
 
   if(IsSensor(gene.type)) {
@@ -286,6 +406,20 @@ void Genome::AddNodeGene(NodeGene gene) {
     num_outputs++;
   }
 
+  if(IsSensor(gene.type)) {
+    // Sensors go before every other node, changing their indices.
+    reachability.reset();
+    enabled_reachability.reset();
+  } else {
+    // Other nodes are appended.
+    if(reachability) {
+      unshare(reachability).AddNode();
+    }
+    if(enabled_reachability) {
+      unshare(enabled_reachability).AddNode();
+    }
+  }
+
 
 
   if(needs_resort) {
@@ -298,11 +432,14 @@ void Genome::AddNodeGene(NodeGene gene) {
     // Regenerate the lookup table.
     node_lookup.clear();
     for(unsigned int i=0; i<node_genes.size(); i++) {
-      node_lookup[node_genes[i].innovation] = i;
+      node_lookup.push_back({node_genes[i].innovation, i});
     }
+    std::sort(node_lookup.begin(), node_lookup.end());
   } else {
     // Just add the new gene to the lookup.
-    node_lookup[gene.innovation] = node_genes.size();
+    auto pos = std::lower_bound(node_lookup.begin(), node_lookup.end(),
+                                std::make_pair(gene.innovation, 0u));
+    node_lookup.insert(pos, {gene.innovation, node_genes.size()});
     node_genes.push_back(gene);
   }
 
@@ -312,25 +449,98 @@ void Genome::AddNodeGene(NodeGene gene) {
 }
 
 void Genome::AddConnectionGene(ConnectionGene gene) {
-  if(connection_lookup.count(gene.innovation) != 0 ||
-     node_lookup.count(gene.origin) == 0 ||
-     node_lookup.count(gene.dest) == 0 ||
-     connections_existing.count({gene.origin, gene.dest}) ||
-     IsSensor(GetNodeByInnovation(gene.dest)->type)) {
-    return;
+  if(connections_existing.size() != connection_genes.size()) {
+    // Not copied with the genome, so rebuild it.
+    connections_existing.clear();
+    connections_existing.reserve(connection_genes.size() + 1);
+    for(auto& existing : connection_genes) {
+      connections_existing.push_back({existing.origin, existing.dest});
+    }
+    std::sort(connections_existing.begin(), connections_existing.end());
   }
 
+  auto lookup_pos = lower_bound_innovation(connection_lookup, connection_genes, gene.innovation);
+  auto endpoints = std::make_pair(gene.origin, gene.dest);
+  auto existing_pos = std::lower_bound(connections_existing.begin(), connections_existing.end(),
+                                       endpoints);
+
   auto dest = GetNodeByInnovation(gene.dest);
-  assert(dest);
-  assert(!IsSensor(dest->type));
+  if((lookup_pos != connection_lookup.end() &&
+      connection_genes[*lookup_pos].innovation == gene.innovation) ||
+     !HasNode(gene.origin) ||
+     !dest ||
+     (existing_pos != connections_existing.end() && *existing_pos == endpoints) ||
+     IsSensor(dest->type)) {
+    return;
+  }
 
-  connection_lookup[gene.innovation] = connection_genes.size();
+  connection_lookup.insert(lookup_pos, connection_genes.size());
   connection_genes.push_back(gene);
-  connections_existing.insert({gene.origin, gene.dest});
+  connections_existing.insert(existing_pos, endpoints);
   last_conn_innov = gene.innovation;
+
+  if(reachability || (gene.enabled && enabled_reachability)) {
+    auto i = NodeIndex(gene.origin);
+    auto j = dest - nodes->genes.data();
+    if(reachability) {
+      unshare(reachability).AddConnection(i,j);
+    }
+    if(gene.enabled && enabled_reachability) {
+      unshare(enabled_reachability).AddConnection(i,j);
+    }
+  }
+}
+
+const std::vector<NodeGene>& Genome::NodeGenes() const {
+  static const std::vector<NodeGene> no_nodes;
+  return nodes ? nodes->genes : no_nodes;
+}
+
+Genome::NodeTable& Genome::MutableNodes() {
+  if(!nodes) {
+    nodes = std::make_shared<NodeTable>();
+  }
+  return unshare(nodes);
+}
+
+bool Genome::HasNode(unsigned long innovation) const {
+  return GetNodeByInnovation(innovation) != nullptr;
+}
+
+unsigned int Genome::NodeIndex(unsigned long innovation) const {
+  auto node = GetNodeByInnovation(innovation);
+  assert(node);
+  return node - nodes->genes.data();
+}
+
+ReachabilityChecker Genome::BuildReachability(bool enabled_only) const {
+  ReachabilityChecker checker(NodeGenes().size(),num_inputs);
+  for(auto& gene : connection_genes) {
+    if (gene.enabled || !enabled_only) {
+      int i = NodeIndex(gene.origin);
+      int j = NodeIndex(gene.dest);
+      checker.AddConnection(i,j);
+    }
+  }
+  return checker;
+}
+
+const ReachabilityChecker& Genome::Reachability() {
+  if(!reachability) {
+    reachability = std::make_shared<ReachabilityChecker>(BuildReachability(false));
+  }
+  return *reachability;
+}
+
+std::shared_ptr<const ReachabilityChecker> Genome::EnabledReachability() const {
+  if(enabled_reachability) {
+    return enabled_reachability;
+  }
+  return std::make_shared<ReachabilityChecker>(BuildReachability(true));
 }
 
 const NodeGene* Genome::GetNodeByN(unsigned int i) const {
+  auto& node_genes = NodeGenes();
   if(i < node_genes.size()) {
     return &node_genes[i];
   } else {
@@ -339,9 +549,14 @@ const NodeGene* Genome::GetNodeByN(unsigned int i) const {
 }
 
 const NodeGene* Genome::GetNodeByInnovation(unsigned long innovation) const {
-  auto iter = node_lookup.find(innovation);
-  if(iter != node_lookup.end()) {
-    return &node_genes[iter->second];
+  if(!nodes) {
+    return nullptr;
+  }
+  auto& lookup = nodes->lookup;
+  auto iter = std::lower_bound(lookup.begin(), lookup.end(),
+                               std::make_pair(innovation, 0u));
+  if(iter != lookup.end() && iter->first == innovation) {
+    return &nodes->genes[iter->second];
   } else {
     return nullptr;
   }
@@ -356,26 +571,14 @@ const ConnectionGene* Genome::GetConnByN(unsigned int i) const {
 }
 
 const ConnectionGene* Genome::GetConnByInnovation(unsigned long innovation) const {
-  auto iter = connection_lookup.find(innovation);
-  if(iter != connection_lookup.end()) {
-    return &connection_genes[iter->second];
+  auto iter = lower_bound_innovation(connection_lookup, connection_genes, innovation);
+  if(iter != connection_lookup.end() && connection_genes[*iter].innovation == innovation) {
+    return &connection_genes[*iter];
   } else {
     return nullptr;
   }
 }
 
-NodeGene* Genome::GetNodeByN(unsigned int i) {
-  return const_cast<NodeGene*>(
-    const_cast<const Genome*>(this)->GetNodeByN(i)
-  );
-}
-
-NodeGene* Genome::GetNodeByInnovation(unsigned long innovation) {
-  return const_cast<NodeGene*>(
-    const_cast<const Genome*>(this)->GetNodeByInnovation(innovation)
-  );
-}
-
 ConnectionGene* Genome::GetConnByN(unsigned int i) {
   return const_cast<ConnectionGene*>(
     const_cast<const Genome*>(this)->GetConnByN(i)
@@ -401,6 +604,12 @@ void Genome::Mutate() {
   if (random() < required()->mutation_prob_adjust_weights) { MutateWeights(); }
   if (random() < required()->mutation_prob_toggle_connection) { MutateToggleGeneStatus(); }
   if (random() < required()->mutation_prob_reenable_connection) { MutateReEnableGene(); }
+
+  // Nearly every genome is made into a network, so keep the checker for
+  // it, to be shared with any copies.
+  if (!enabled_reachability) {
+    enabled_reachability = std::make_shared<ReachabilityChecker>(BuildReachability(true));
+  }
 }
 
 void Genome::MutateWeights() {
@@ -417,12 +626,7 @@ void Genome::MutateWeights() {
 }
 
 void Genome::MutateConnection() {
-  ReachabilityChecker checker(node_genes.size(),num_inputs);
-  for(auto& gene : connection_genes) {
-    int i = node_lookup.at(gene.origin);
-    int j = node_lookup.at(gene.dest);
-    checker.AddConnection(i,j);
-  }
+  auto& checker = Reachability();
 
   int idxorigin, idxdest;
 
@@ -466,6 +670,10 @@ void Genome::MutateNode() {
     return;
   }
 
+  // Connections cannot be removed from a checker, so the one for the
+  // enabled genes is rebuilt later.
+  enabled_reachability.reset();
+
   // add a new node:
   // use the to-be disabled gene's innovation as ingredient for this new nodes innovation hash
   auto new_node_innov = Hash(split_conn.innovation, last_node_innov);
@@ -498,6 +706,10 @@ void Genome::MutateToggleGeneStatus() {
   auto selected = connection_genes.begin();
   std::advance(selected,idx);
   selected->enabled = !selected->enabled;
+
+  // Connections cannot be removed from a checker, and one added out of
+  // order could be recurrent where the network's would be normal.
+  enabled_reachability.reset();
 }
 
 void Genome::MutateReEnableGene() {
@@ -514,6 +726,10 @@ void Genome::MutateReEnableGene() {
   auto selected = connection_genes.begin();
   std::advance(selected,disabled_indices[idx]);
   selected->enabled = true;
+
+  // Added out of order, the connection could be recurrent in the
+  // checker where it would be normal in the network.
+  enabled_reachability.reset();
 }
 
 void Genome::PrintInnovations() const {
@@ -525,6 +741,8 @@ void Genome::PrintInnovations() const {
 
 
 bool Genome::ConnectivityCheck(unsigned int node_index, const ReachabilityChecker& checker) const {
+  auto& node_genes = NodeGenes();
+
   // bias node should always be present
   if (node_genes[node_index].type == NodeType::Bias) { return true; }
 
@@ -553,13 +771,35 @@ bool Genome::ConnectivityCheck(unsigned int node_index, const ReachabilityChecke
   return true;
 }
 
+size_t Genome::MemoryUsage() const {
+  size_t bytes = sizeof(Genome);
+  bytes += connection_genes.capacity()*sizeof(ConnectionGene);
+  bytes += connection_lookup.capacity()*sizeof(decltype(connection_lookup)::value_type);
+  bytes += connections_existing.capacity()*sizeof(decltype(connections_existing)::value_type);
+
+  if(nodes) {
+    size_t node_bytes = sizeof(NodeTable);
+    node_bytes += nodes->genes.capacity()*sizeof(NodeGene);
+    node_bytes += nodes->lookup.capacity()*sizeof(decltype(nodes->lookup)::value_type);
+    bytes += node_bytes/nodes.use_count();
+  }
+  if(reachability) {
+    bytes += reachability->MemoryUsage()/reachability.use_count();
+  }
+  if(enabled_reachability) {
+    bytes += enabled_reachability->MemoryUsage()/enabled_reachability.use_count();
+  }
+
+  return bytes;
+}
+
 bool Genome::IsStructurallyEqual(const Genome& other) const {
-  if(node_genes.size() != other.node_genes.size() ||
+  if(NodeGenes().size() != other.NodeGenes().size() ||
      connection_genes.size() != other.connection_genes.size()) {
     return false;
   }
 
-  for(auto& gene : node_genes) {
+  for(auto& gene : NodeGenes()) {
     if(!other.GetNodeByInnovation(gene.innovation)) {
       return false;
     }
@@ -574,17 +814,37 @@ bool Genome::IsStructurallyEqual(const Genome& other) const {
   return true;
 }
 
+unsigned long Genome::StructuralHash() const {
+  unsigned long hash = hash_combine(0, NodeGenes().size());
+  for(auto& gene : NodeGenes()) {
+    hash = hash_combine(hash, gene.innovation);
+    hash = hash_combine(hash, static_cast<unsigned long>(gene.type));
+  }
+  for(auto& gene : connection_genes) {
+    if(gene.enabled) {
+      hash = hash_combine(hash, gene.origin);
+      hash = hash_combine(hash, gene.dest);
+    }
+  }
+  return hash;
+}
+
 void Genome::AssertNoDuplicateConnections() const {
-  for(auto& gene1 : connection_genes) {
-    for(auto& gene2 : connection_genes) {
-      assert( &gene1 == &gene2 ||
-              gene1.origin != gene2.origin ||
-              gene1.dest != gene2.dest);
+  // Each gene adds its endpoints to connections_existing, which holds
+  // each pair of endpoints only once.  It is not copied with the
+  // genome, in which case check a sorted copy of the endpoints.
+  if(connections_existing.size() != connection_genes.size()) {
+    std::vector<std::pair<unsigned long, unsigned long> > endpoints;
+    for(auto& gene : connection_genes) {
+      endpoints.push_back({gene.origin, gene.dest});
     }
+    std::sort(endpoints.begin(), endpoints.end());
+    assert(std::adjacent_find(endpoints.begin(), endpoints.end()) == endpoints.end());
   }
 }
 
 void Genome::AssertInputNodesFirst() const {
+  auto& node_genes = NodeGenes();
   for(unsigned int i=0; i<num_inputs; i++) {
     assert(IsSensor(node_genes[i].type));
   }
@@ -606,9 +866,10 @@ std::ostream& operator<<(std::ostream& os, const Genome& genome) {
   unsigned int num_outputs = 0;
   unsigned int num_hidden = 0;
 
-  for(unsigned int i=0; i<genome.node_genes.size(); i++) {
+  auto& node_genes = genome.NodeGenes();
+  for(unsigned int i=0; i<node_genes.size(); i++) {
     std::stringstream ss;
-    switch(genome.node_genes[i].type) {
+    switch(node_genes[i].type) {
       case NodeType::Input:
         ss << "I" << num_inputs++;
         break;
@@ -623,11 +884,11 @@ std::ostream& operator<<(std::ostream& os, const Genome& genome) {
         break;
 
       default:
-        std::cerr << "Type: " << int(genome.node_genes[i].type) << std::endl;
+        std::cerr << "Type: " << int(node_genes[i].type) << std::endl;
         assert(false);
         break;
     }
-    names[genome.node_genes[i].innovation] = ss.str();
+    names[node_genes[i].innovation] = ss.str();
   }
 
   for(const auto& item : names) {
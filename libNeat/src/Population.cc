@@ -1,10 +1,14 @@
 #include "Population.hh"
+#include "PopulationBatchNet.hh"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <set>
 #include <map>
+#include <random>
 
 Population::Population(std::vector<Species> species,
                        std::shared_ptr<RNG> gen, std::shared_ptr<Probabilities> params)
@@ -33,26 +37,55 @@ Population::Population(Genome& first,
 }
 
 void Population::Speciate(std::vector<Species>& species,
-                          const std::vector<Genome>& genomes) {
-  for(auto& genome : genomes) {
-    bool need_new_species = true;
-    for(auto& spec : species) {
-      double dist = genome.GeneticDistance(spec.representative);
-      if(dist < required()->genetic_distance_species_threshold) {
-        spec.organisms.emplace_back(genome,converter);
-        need_new_species = false;
-        break;
+                          const std::vector<Genome>& genomes,
+                          std::vector<std::unique_ptr<NeuralNet> >* nets) {
+  auto threshold = required()->genetic_distance_species_threshold;
+
+  // Find the first of the existing species that each genome is close
+  // enough to join.  Species only gain members below, so their
+  // representatives stay the same, and the genomes can be compared
+  // against them in parallel.
+  auto num_existing = species.size();
+  std::vector<int> matching_species(genomes.size(), -1);
+  auto find_existing_species = [&](size_t begin, size_t end) {
+    for (auto i=begin; i<end; i++) {
+      for (auto j=0u; j<num_existing; j++) {
+        if (genomes[i].GeneticDistance(species[j].representative) < threshold) {
+          matching_species[i] = j;
+          break;
+        }
       }
     }
+  };
+
+  ParallelFor(genomes.size(), find_existing_species);
+
+  // Assign in order.  Species started during this pass come after the
+  // existing ones, so are only checked if none of those matched.
+  for (auto i=0u; i<genomes.size(); i++) {
+    auto& genome = genomes[i];
+    int match = matching_species[i];
+    for (auto j=num_existing; match < 0 && j<species.size(); j++) {
+      if (genome.GeneticDistance(species[j].representative) < threshold) {
+        match = j;
+      }
+    }
+
+    std::unique_ptr<NeuralNet> net;
+    if (nets) {
+      net = std::move((*nets)[i]);
+    }
 
-    if(need_new_species) {
+    if (match >= 0) {
+      species[match].organisms.emplace_back(genome,converter,std::move(net));
+    } else {
       Species new_spec;
       new_spec.id = random()*(1<<24);
       new_spec.representative = genome;
       new_spec.age = 0;
       //new_spec.age_since_last_improvement = 0;
       new_spec.best_fitness = 0;
-      new_spec.organisms.emplace_back(genome,converter);
+      new_spec.organisms.emplace_back(genome,converter,std::move(net));
 
       species.push_back(new_spec);
     }
@@ -70,30 +103,99 @@ void Population::CalculateAdjustedFitness() {
 
 
   // adj_fitness = fitness/ number_of_genetically_similar_in_species
+  auto threshold = required()->genetic_distance_species_threshold;
+  bool sampled = required()->fitness_sharing == FitnessSharing::Sampled;
+  size_t num_samples = required()->fitness_sharing_samples;
+
+  // One row per organism, with the range of its species in organisms.
+  struct sharing_row {
+    size_t species_begin;
+    size_t species_end;
+    bool sampled;
+    unsigned long seed;
+  };
+  std::vector<Organism*> organisms;
+  std::vector<sharing_row> rows;
   for(auto& spec : species) {
+    size_t begin = organisms.size();
+    size_t end = begin + spec.organisms.size();
+    // Sampling only saves time if there are more others than samples.
+    bool sample_species = sampled && spec.organisms.size() > num_samples + 1;
     for(auto& org : spec.organisms) {
-      int nearby_in_species = 0;
+      organisms.push_back(&org);
+      unsigned long seed = sample_species ? random()*std::numeric_limits<uint32_t>::max() : 0;
+      rows.push_back({begin, end, sample_species, seed});
+    }
+  }
 
-      for(auto& other : spec.organisms) {
-        double dist = org.genome.GeneticDistance(other.genome);
-        if(dist < required()->genetic_distance_species_threshold) {
-          nearby_in_species++;
+  // Each organism counts itself.  Exact rows only compare against the
+  // organisms after them, counting each close pair for both organisms,
+  // so that every distance is computed once.
+  std::vector<std::atomic<unsigned int> > nearby(organisms.size());
+  for(auto& count : nearby) {
+    count.store(1, std::memory_order_relaxed);
+  }
+  std::vector<double> nearby_estimate(organisms.size(), 0);
+
+  ParallelFor(organisms.size(), [&](size_t begin, size_t end) {
+      for(auto i=begin; i<end; i++) {
+        auto& row = rows[i];
+        auto& genome = organisms[i]->genome;
+
+        if(row.sampled) {
+          // Draw others uniformly, with replacement, skipping over i.
+          std::mt19937 gen(row.seed);
+          std::uniform_int_distribution<size_t> dist(row.species_begin, row.species_end - 2);
+          unsigned int hits = 0;
+          for(auto s=0u; s<num_samples; s++) {
+            auto j = dist(gen);
+            j += (j >= i);
+            if(genome.GeneticDistance(organisms[j]->genome) < threshold) {
+              hits++;
+            }
+          }
+          auto num_others = row.species_end - row.species_begin - 1;
+          nearby_estimate[i] = 1 + double(num_others)*hits/num_samples;
+        } else {
+          unsigned int hits = 0;
+          for(auto j=i+1; j<row.species_end; j++) {
+            if(genome.GeneticDistance(organisms[j]->genome) < threshold) {
+              hits++;
+              nearby[j].fetch_add(1, std::memory_order_relaxed);
+            }
+          }
+          nearby[i].fetch_add(hits, std::memory_order_relaxed);
         }
       }
+    });
 
-      org.adj_fitness = org.fitness/nearby_in_species;
-    }
+  for(auto i=0u; i<organisms.size(); i++) {
+    double nearby_in_species = rows[i].sampled ? nearby_estimate[i] : nearby[i].load();
+    organisms[i]->adj_fitness = organisms[i]->fitness/nearby_in_species;
   }
 }
 
 void Population::Evaluate(std::function<std::unique_ptr<FitnessEvaluator>(void)> evaluator_factory) {
   if (use_composite_net) {
     EvaluateComposite(evaluator_factory);
+  } else if (use_batch_net) {
+    EvaluateBatched(evaluator_factory);
   } else {
     EvaluateSequential(evaluator_factory);
   }
 }
 
+void Population::SetNumThreads(unsigned int num_threads) {
+  if (num_threads == 1) {
+    thread_pool = nullptr;
+  } else {
+    thread_pool = std::make_shared<ThreadPool>(num_threads);
+    if (thread_pool->num_threads() == 1) {
+      thread_pool = nullptr;
+    }
+  }
+}
+
 void Population::EvaluateSequential(std::function<std::unique_ptr<FitnessEvaluator>(void)> evaluator_factory) {
   struct fitness_kernel {
     NetProxy proxy;
@@ -115,21 +217,25 @@ void Population::EvaluateSequential(std::function<std::unique_ptr<FitnessEvaluat
     }
   }
 
+  // Runs func(kernel) for every kernel, over the thread pool if there is one.
+  auto for_each_kernel = [&](auto&& func) {
+    ParallelFor(kernels.size(), [&](size_t begin, size_t end) {
+        for (auto i=begin; i<end; i++) { func(kernels[i]); }
+      });
+  };
+
   while (true) {
-    bool continue_looping = false;
+    std::atomic<bool> continue_looping(false);
     // load one set of inputs for each network
-    // or finalize and set fitness value
-    for (auto& kernel : kernels) {
-      kernel.eval->step(kernel.proxy);
-    }
-
-    // eval each network with loaded inputs
-    for (auto& kernel : kernels) {
-      if (kernel.proxy.has_inputs()) {
-        kernel.result = kernel.proxy.evaluate();
-        continue_looping = true;
-      }
-    }
+    // or finalize and set fitness value,
+    // then eval each network with loaded inputs
+    for_each_kernel([&](fitness_kernel& kernel) {
+        kernel.eval->step(kernel.proxy);
+        if (kernel.proxy.has_inputs()) {
+          kernel.proxy.evaluate(kernel.result);
+          continue_looping.store(true, std::memory_order_relaxed);
+        }
+      });
 
     // if there are no more inputs then
     // the fitness function has been evaluated
@@ -137,10 +243,12 @@ void Population::EvaluateSequential(std::function<std::unique_ptr<FitnessEvaluat
     if (!continue_looping) { break; }
 
     // call the proxy callbacks
-    for (auto& kernel : kernels) {
-      kernel.proxy.callback(kernel.result);
-      kernel.proxy.clear();
-    }
+    for_each_kernel([&](fitness_kernel& kernel) {
+        if (kernel.proxy.has_inputs()) {
+          kernel.proxy.callback(kernel.result);
+          kernel.proxy.clear();
+        }
+      });
   }
 
   CalculateAdjustedFitness();
@@ -174,7 +282,7 @@ void Population::EvaluateComposite(std::function<std::unique_ptr<FitnessEvaluato
   size_t num_outputs = genomes[0]->NumOutputs();
 
 
-  auto composite_net = converter->convert(genomes,heterogeneous_inputs);
+  auto composite_net = converter->convert(genomes,heterogeneous_inputs,thread_pool.get());
 
   while (true) {
     bool continue_looping = false;
@@ -236,17 +344,87 @@ void Population::EvaluateComposite(std::function<std::unique_ptr<FitnessEvaluato
   CalculateAdjustedFitness();
 }
 
+void Population::EvaluateBatched(std::function<std::unique_ptr<FitnessEvaluator>(void)> evaluator_factory) {
+  struct fitness_kernel {
+    NetProxy proxy;
+    std::unique_ptr<FitnessEvaluator> eval;
+    std::vector<_float_> result;
+  };
+
+  int num_organisms = 0;
+  for (auto& spec : species) {
+    num_organisms += spec.organisms.size();
+  }
+  std::vector<fitness_kernel> kernels;
+  kernels.reserve(num_organisms);
+
+  PopulationBatchNet batch;
+  for (auto& spec : species) {
+    for (auto& org : spec.organisms) {
+      kernels.push_back({ &org, evaluator_factory(), {} });
+      batch.add_network(*org.network());
+    }
+  }
+
+  std::vector<_float_> all_inputs(batch.num_inputs(), 0);
+  std::vector<_float_> all_outputs(batch.num_outputs(), 0);
+  std::vector<bool> active(kernels.size());
+
+  while (true) {
+    bool continue_looping = false;
+    // load one set of inputs for each network
+    // or finalize and set fitness value
+    for (auto i=0u; i<kernels.size(); i++) {
+      auto& kernel = kernels[i];
+      kernel.eval->step(kernel.proxy);
+      active[i] = kernel.proxy.has_inputs();
+      if (active[i]) {
+        assert(kernel.proxy.inputs.size() == batch.num_inputs(i));
+        std::copy(kernel.proxy.inputs.begin(), kernel.proxy.inputs.end(),
+                  all_inputs.begin() + batch.input_offset(i));
+        continue_looping = true;
+      } else {
+        // The network keeps its state, as if it were not evaluated.
+        std::fill(all_inputs.begin() + batch.input_offset(i),
+                  all_inputs.begin() + batch.input_offset(i) + batch.num_inputs(i), 0);
+      }
+    }
+
+    // if there are no more inputs then
+    // the fitness function has been evaluated
+    // and we are done
+    if (!continue_looping) { break; }
+
+    batch.evaluate(all_inputs, all_outputs, active);
+
+    // call the proxy callbacks
+    for (auto i=0u; i<kernels.size(); i++) {
+      auto& kernel = kernels[i];
+      if (kernel.proxy.has_inputs()) {
+        auto first = all_outputs.begin() + batch.output_offset(i);
+        kernel.result.assign(first, first + batch.num_outputs(i));
+        kernel.proxy.callback(kernel.result);
+        kernel.proxy.clear();
+      }
+    }
+  }
+
+  CalculateAdjustedFitness();
+}
 
 Population Population::Reproduce() {
   auto next_gen_species = MakeNextGenerationSpecies();
-  auto next_gen_genomes = MakeNextGenerationGenomes();
+  std::vector<std::unique_ptr<NeuralNet> > next_gen_nets;
+  auto next_gen_genomes = MakeNextGenerationGenomes(next_gen_nets);
 
-  Speciate(next_gen_species, next_gen_genomes);
+  Speciate(next_gen_species, next_gen_genomes, &next_gen_nets);
 
   Population pop(next_gen_species, get_generator(), required());
   pop.converter = converter;
   pop.use_composite_net = use_composite_net;
   pop.heterogeneous_inputs = heterogeneous_inputs;
+  pop.use_batch_net = use_batch_net;
+  pop.thread_pool = thread_pool;
 
   return pop;
 }
@@ -390,14 +568,26 @@ void Population::DistributeNurseryChildren(std::vector<unsigned int>& number_of_
 
 }
 
-std::vector<Genome> Population::MakeNextGenerationGenomes() {
+std::vector<Genome> Population::MakeNextGenerationGenomes(std::vector<std::unique_ptr<NeuralNet> >& nets) {
 
   std::vector<unsigned int> num_children_by_species(species.size(),0);
   DistributeNurseryChildren(num_children_by_species);
   DistributeChildrenByRank(num_children_by_species);
 
-  std::vector<Genome> progeny;
-  //std::vector<Genome> progeny;
+  // Parents of one child.  father is null for a copy of the mother,
+  // which is mutated unless it is a preserved champion.
+  struct child_plan {
+    const Organism* mother;
+    const Genome* father;
+    bool mutate;
+    unsigned long seed;
+  };
+
+  // Choose the parents of every child, and a seed for the random
+  // numbers it uses, in order on the population's generator.  The
+  // children themselves may then be made in any order, on any number
+  // of threads, with the same result.
+  std::vector<child_plan> plans;
   for(unsigned int i=0; i<species.size(); i++) {
     auto& org_list = species[i].organisms;
     double num_children = num_children_by_species[i];
@@ -405,51 +595,82 @@ std::vector<Genome> Population::MakeNextGenerationGenomes() {
     for(int i=0; i<num_children; i++) {
       if(i==0 && org_list.size() > required()->min_size_for_champion) {
         // Preserve the champion of large species.
-        progeny.emplace_back(org_list.front().genome);
+        plans.push_back({ &org_list.front(), nullptr, false, 0 });
+        continue;
+      }
+
+      // Everyone else can mate
+      float culling_ratio = required()->culling_ratio;
+      unsigned long seed = random()*std::numeric_limits<uint32_t>::max();
+
+      // If only one organisms would be allowed to reproduce, just
+      // take that one organism.
+      if (org_list.size()*culling_ratio <= 1) {
+        plans.push_back({ &org_list.front(), nullptr, true, seed });
+        continue;
+      }
+
+      int idx1 = random()*org_list.size()*culling_ratio;
+      int idx2 = random()*org_list.size()*culling_ratio;
+      // while (idx1 == idx2) {
+      //   idx1 = random()*org_list.size()*culling_ratio;
+      //   idx2 = random()*org_list.size()*culling_ratio;
+      // }
+      Organism& parent1 = org_list[idx1];
+      Organism& parent2 = org_list[idx2];
+
+      // determine relative fitness for mating
+      bool parent1_is_mother;
+      if (parent1.fitness > parent2.fitness) {
+        parent1_is_mother = true;
+      } else if (parent2.fitness > parent1.fitness) {
+        parent1_is_mother = false;
       } else {
-        // Everyone else can mate
-        float culling_ratio = required()->culling_ratio;
-
-        // If only one organisms would be allowed to reproduce, just
-        // take that one organism.
-        if (org_list.size()*culling_ratio <= 1) {
-          auto mutant = org_list.front().genome;
-          mutant.Mutate();
-          progeny.emplace_back(mutant);
-          continue;
-        }
+        // break a fitness tie with a check on size
+        // (equal size or parent 2 is larger)
+        parent1_is_mother = parent1.genome.Size() > parent2.genome.Size();
+      }
 
-        int idx1 = random()*org_list.size()*culling_ratio;
-        int idx2 = random()*org_list.size()*culling_ratio;
-        // while (idx1 == idx2) {
-        //   idx1 = random()*org_list.size()*culling_ratio;
-        //   idx2 = random()*org_list.size()*culling_ratio;
-        // }
-        Organism& parent1 = org_list[idx1];
-        Organism& parent2 = org_list[idx2];
-        Genome child;
-
-        // determine relative fitness for mating
-        if (parent1.fitness > parent2.fitness) {
-          child = parent1.genome.MateWith(parent2.genome);
-        } else if (parent2.fitness > parent1.fitness) {
-          child = parent2.genome.MateWith(parent1.genome);
+      if (parent1_is_mother) {
+        plans.push_back({ &parent1, &parent2.genome, true, seed });
+      } else {
+        plans.push_back({ &parent2, &parent1.genome, true, seed });
+      }
+    }
+  }
+
+  std::vector<Genome> progeny(plans.size());
+  nets.clear();
+  nets.resize(plans.size());
+  auto make_children = [&](size_t begin, size_t end) {
+    for (auto i=begin; i<end; i++) {
+      auto& plan = plans[i];
+      auto& mother = plan.mother->genome;
+      auto& child = progeny[i];
+      if (!plan.mutate) {
+        child = mother;
+      } else {
+        auto gen = std::make_shared<RNG_MersenneTwister>(plan.seed);
+        if (plan.father) {
+          child = mother.MateWith(*plan.father, gen);
         } else {
-          // break a fitness tie with a check on size
-          if (parent1.genome.Size() > parent2.genome.Size()) {
-            child = parent1.genome.MateWith(parent2.genome);
-          }
-          else { // equal size or parent 2 is larger
-            child = parent2.genome.MateWith(parent1.genome);
-          }
+          child = mother;
+          child.set_generator(gen);
         }
         child.Mutate();
-        progeny.emplace_back(child);
-
+        child.set_generator(get_generator());
+      }
 
+      // A child differing from its mother only in its weights gets a
+      // copy of her network, rather than sorting its own.
+      auto mother_net = plan.mother->built_network();
+      if (mother_net && child.StructuralHash() == mother.StructuralHash()) {
+        nets[i] = child.MakeNetLike(*mother_net);
       }
     }
-  }
+  };
+
+  ParallelFor(plans.size(), make_children);
 
   return progeny;
 }
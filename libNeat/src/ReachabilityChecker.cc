@@ -1,109 +1,208 @@
 #include "ReachabilityChecker.hh"
 
+#include <algorithm>
 #include <cassert>
 
 #include "Random.hh"
 
 ReachabilityChecker::ReachabilityChecker(size_t num_nodes, size_t num_inputs)
   : num_nodes(num_nodes), num_inputs(num_inputs),
-    num_possible_normal_connections((num_nodes-num_inputs)*(num_nodes-1)),
-    num_possible_recurrent_connections(num_nodes-num_inputs),
-    mat(num_nodes*num_nodes) {
+    has_normal(num_nodes), has_recurrent(num_nodes),
+    reachable_normal(num_nodes), reachable_either(num_nodes) {
   // All nodes are reachable from themselves
   // Doesn't count as a connection, though
   for(size_t i=0; i<num_nodes; i++) {
-    at(i,i).reachable_normal = true;
-    at(i,i).reachable_either = true;
+    reachable_normal.set(i,i);
+    reachable_either.set(i,i);
+  }
+
+  // Any node may connect normally to a node that is not an input,
+  // except the node itself, to which a connection is recurrent.
+  for(size_t i=0; i<num_nodes; i++) {
+    bool is_input = i < num_inputs;
+    normal_candidates.push_back(is_input ? 0 : num_nodes-1);
+    recurrent_candidates.push_back(is_input ? 0 : 1);
   }
 }
 
-void ReachabilityChecker::AddConnection(size_t origin, size_t destination) {
-  auto& element = at(origin, destination);
+void ReachabilityChecker::BitMatrix::add_node() {
+  size_t new_words_per_row = num_words(num_rows + 1);
+  if(new_words_per_row != words_per_row) {
+    std::vector<uint64_t> new_words(num_rows*new_words_per_row, 0);
+    for(size_t i=0; i<num_rows; i++) {
+      std::copy(row(i), row(i) + words_per_row, new_words.begin() + i*new_words_per_row);
+    }
+    words = std::move(new_words);
+    words_per_row = new_words_per_row;
+  }
 
-  assert(destination >= num_inputs);
-  assert(!element.has_any_connection);
-  element.has_any_connection = true;
+  num_rows++;
+  words.resize(num_rows*words_per_row, 0);
+}
 
-  bool will_be_recurrent = at(destination,origin).reachable_normal;
+void ReachabilityChecker::CountIndex::push_back(size_t count) {
+  counts.push_back(count);
+  sum += count;
 
-  if(will_be_recurrent) {
-    element.has_recurrent_connection = true;
-    num_possible_recurrent_connections--;
-    fill_either_reachable(origin,destination);
-  } else {
-    element.has_normal_connection = true;
-    num_possible_normal_connections--;
-    fill_normal_reachable(origin,destination);
-    fill_either_reachable(origin,destination);
+  // The new node of the tree covers itself, and the nodes below it.
+  size_t i = counts.size();
+  size_t lowest = i & (~i + 1);
+  for(size_t child = i-1; child > i-lowest; child -= child & (~child + 1)) {
+    count += tree[child-1];
   }
+  tree.push_back(count);
 }
 
-void ReachabilityChecker::fill_normal_reachable(size_t origin, size_t destination) {
-  // If we already knew that it was reachable, no more work to be done.
-  if(at(origin,destination).reachable_normal) {
-    return;
+void ReachabilityChecker::CountIndex::add(size_t i, long delta) {
+  counts[i] += delta;
+  sum += delta;
+  for(i++; i <= tree.size(); i += i & (~i + 1)) {
+    tree[i-1] += delta;
   }
+}
 
-  // We can reach from the origin to the destination
-  at(origin,destination).reachable_normal = true;
-
-  //Now that destination is normal-reachable from origin, a connection
-  //from destination to origin would now be recurrent, rather than
-  //normal.  Only do the modification if there could have been a
-  //connection added from destination to origin.  That is, if origin
-  //is not an input node.
-  if(origin >= num_inputs) {
-    num_possible_normal_connections--;
-    num_possible_recurrent_connections++;
+void ReachabilityChecker::CountIndex::add_from(size_t begin, long delta) {
+  for(size_t i=begin; i<counts.size(); i++) {
+    counts[i] += delta;
+    sum += delta;
   }
+  rebuild();
+}
 
-  // Anywhere that can be reached from the destination, we can reach
-  for(size_t i=0; i<num_nodes; i++) {
-    if(at(destination,i).reachable_normal) {
-      fill_normal_reachable(origin,i);
+void ReachabilityChecker::CountIndex::rebuild() {
+  tree = counts;
+  for(size_t i=1; i<=tree.size(); i++) {
+    size_t parent = i + (i & (~i + 1));
+    if(parent <= tree.size()) {
+      tree[parent-1] += tree[i-1];
     }
   }
+}
 
-  // Anywhere that can reach us, can now reach the destination
-  for(size_t i=0; i<num_nodes; i++) {
-    if(at(i,origin).reachable_normal) {
-      fill_normal_reachable(i,destination);
+size_t ReachabilityChecker::CountIndex::find(size_t& k) const {
+  assert(k < sum);
+
+  // Descend the tree, keeping the prefix before pos at most k.
+  size_t pos = 0;
+  size_t step = 1;
+  while(2*step <= tree.size()) {
+    step *= 2;
+  }
+  for(; step > 0; step /= 2) {
+    if(pos + step <= tree.size() && tree[pos+step-1] <= k) {
+      pos += step;
+      k -= tree[pos-1];
     }
   }
+  return pos;
 }
 
-void ReachabilityChecker::fill_either_reachable(size_t origin, size_t destination) {
-  // If we already knew that it was reachable, no more work to be done.
-  if(at(origin,destination).reachable_either) {
-    return;
+void ReachabilityChecker::AddNode() {
+  has_normal.add_node();
+  has_recurrent.add_node();
+  reachable_normal.add_node();
+  reachable_either.add_node();
+
+  // Nothing can reach the new node, nor be reached from it.  Any other
+  // node may connect to it normally, and it may connect normally to
+  // any other node that is not an input.  A connection to itself is
+  // recurrent.
+  normal_candidates.add_from(num_inputs, 1);
+  normal_candidates.push_back(num_nodes);
+  recurrent_candidates.push_back(1);
+
+  num_nodes++;
+  reachable_normal.set(num_nodes-1,num_nodes-1);
+  reachable_either.set(num_nodes-1,num_nodes-1);
+}
+
+void ReachabilityChecker::AddConnection(size_t origin, size_t destination) {
+  assert(destination >= num_inputs);
+  assert(!HasConnection(origin,destination));
+
+  bool will_be_recurrent = reachable_normal.get(destination,origin);
+
+  if(will_be_recurrent) {
+    has_recurrent.set(destination,origin);
+    recurrent_candidates.add(destination, -1);
+  } else {
+    has_normal.set(destination,origin);
+    normal_candidates.add(destination, -1);
+    fill_reachable(reachable_normal, origin, destination, true);
   }
+  fill_reachable(reachable_either, origin, destination, false);
+}
 
-  // We can reach from the origin to the destination
-  at(origin,destination).reachable_either = true;
+void ReachabilityChecker::fill_reachable(BitMatrix& reachable, size_t origin, size_t destination,
+                                         bool update_candidates) {
+  // Anything that can reach the origin can now reach anything that the
+  // destination can reach.  A path using the new connection twice
+  // contains a shorter one using it once, so one pass suffices.  The
+  // row of the destination only changes if it reaches the origin, in
+  // which case it is combined with itself, and so stays the same.
+  const uint64_t* destination_row = reachable.row(destination);
+  size_t num_words = reachable.row_words();
 
-  // Anywhere that can be reached from the destination, we can reach
   for(size_t i=0; i<num_nodes; i++) {
-    if(at(destination,i).reachable_either) {
-      fill_either_reachable(origin,i);
+    if(!reachable.get(i,origin)) {
+      continue;
+    }
+
+    uint64_t* row = reachable.row(i);
+    long num_new = 0;
+    for(size_t w=0; w<num_words; w++) {
+      uint64_t added = destination_row[w] & ~row[w];
+      row[w] |= added;
+      num_new += __builtin_popcountll(added);
+    }
+
+    // Now that j is normal-reachable from i, a connection from j to i
+    // would be recurrent, rather than normal.  There cannot already be
+    // one: a normal connection would have closed a normal loop, and a
+    // recurrent one requires j to have been reachable already.
+    if(update_candidates && num_new && i >= num_inputs) {
+      normal_candidates.add(i, -num_new);
+      recurrent_candidates.add(i, num_new);
     }
   }
+}
 
-  // Anywhere that can reach us, can now reach the destination
-  for(size_t i=0; i<num_nodes; i++) {
-    if(at(i,origin).reachable_either) {
-      fill_either_reachable(i,destination);
+size_t ReachabilityChecker::select_origin(size_t destination, size_t k, bool recurrent) const {
+  const uint64_t* normal_row = has_normal.row(destination);
+  const uint64_t* recurrent_row = has_recurrent.row(destination);
+  const uint64_t* reachable_row = reachable_normal.row(destination);
+  size_t num_words = reachable_normal.row_words();
+
+  for(size_t w=0; w<num_words; w++) {
+    uint64_t connected = normal_row[w] | recurrent_row[w];
+    uint64_t candidates = recurrent ? (reachable_row[w] & ~connected) : ~(reachable_row[w] | connected);
+    if(w == num_words-1 && num_nodes%64) {
+      candidates &= (uint64_t(1) << (num_nodes%64)) - 1;
     }
+
+    size_t count = __builtin_popcountll(candidates);
+    if(k < count) {
+      for(; k>0; k--) {
+        candidates &= candidates - 1;
+      }
+      return w*64 + __builtin_ctzll(candidates);
+    }
+    k -= count;
   }
+
+  // Shouldn't ever reach here
+  assert(false);
+  return 0;
 }
 
-std::pair<int,int> ReachabilityChecker::RandomNormalConnection(RNG& rng) {
+std::pair<int,int> ReachabilityChecker::RandomNormalConnection(RNG& rng) const {
   // Nothing left, don't bother
-  if(num_possible_normal_connections == 0) {
+  if(NumPossibleNormalConnections() == 0) {
     return {-1, -1};
   }
 
   // If we have a decent chance of finding one, try some random elements.
-  double prob = double(num_possible_normal_connections)/double(num_nodes*(num_nodes-num_inputs));
+  double prob = double(NumPossibleNormalConnections())/double(num_nodes*(num_nodes-num_inputs));
   if(prob > 0.25) {
     for(int attempt=0; attempt<10; attempt++) {
       size_t origin = num_nodes*rng();
@@ -114,33 +213,20 @@ std::pair<int,int> ReachabilityChecker::RandomNormalConnection(RNG& rng) {
     }
   }
 
-  // Fallback to a linear search
-  size_t desired_index = num_possible_normal_connections*rng();
-  size_t index = 0;
-  for(size_t origin = 0; origin<num_nodes; origin++) {
-    for(size_t destination = num_inputs; destination<num_nodes; destination++) {
-      if(could_add_normal(origin, destination)) {
-        if(index == desired_index) {
-          return {origin, destination};
-        }
-        index++;
-      }
-    }
-  }
-
-  // Shouldn't ever reach here
-  assert(false);
-  return {-1,-1};
+  // Fallback to picking one by its index
+  size_t desired_index = NumPossibleNormalConnections()*rng();
+  size_t destination = normal_candidates.find(desired_index);
+  return {select_origin(destination, desired_index, false), destination};
 }
 
-std::pair<int,int> ReachabilityChecker::RandomRecurrentConnection(RNG& rng) {
+std::pair<int,int> ReachabilityChecker::RandomRecurrentConnection(RNG& rng) const {
   // Nothing left, don't bother
-  if(num_possible_recurrent_connections == 0) {
+  if(NumPossibleRecurrentConnections() == 0) {
     return {-1, -1};
   }
 
   // If we have a decent chance of finding one, try some random elements.
-  double prob = double(num_possible_recurrent_connections)/double(num_nodes*(num_nodes-num_inputs));
+  double prob = double(NumPossibleRecurrentConnections())/double(num_nodes*(num_nodes-num_inputs));
   if(prob > 0.25) {
     for(int attempt=0; attempt<10; attempt++) {
       size_t origin = num_nodes*rng();
@@ -151,21 +237,8 @@ std::pair<int,int> ReachabilityChecker::RandomRecurrentConnection(RNG& rng) {
     }
   }
 
-  // Fallback to a linear search
-  size_t desired_index = num_possible_recurrent_connections*rng();
-  size_t index = 0;
-  for(size_t origin = 0; origin<num_nodes; origin++) {
-    for(size_t destination = num_inputs; destination<num_nodes; destination++) {
-      if(could_add_recurrent(origin, destination)) {
-        if(index == desired_index) {
-          return {origin, destination};
-        }
-        index++;
-      }
-    }
-  }
-
-  // Shouldn't ever reach here
-  assert(false);
-  return {-1,-1};
+  // Fallback to picking one by its index
+  size_t desired_index = NumPossibleRecurrentConnections()*rng();
+  size_t destination = recurrent_candidates.find(desired_index);
+  return {select_origin(destination, desired_index, true), destination};
 }
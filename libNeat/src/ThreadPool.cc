@@ -0,0 +1,154 @@
+#include "ThreadPool.hh"
+
+#include <algorithm>
+
+namespace {
+  // True on the workers, and on a caller while it runs part of a loop.
+  thread_local bool inside_parallel_for = false;
+}
+
+ThreadPool::ThreadPool(unsigned int num_threads) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  for (auto i=0u; i<num_threads; i++) {
+    shares.push_back(std::make_unique<Share>());
+  }
+  for (auto i=1u; i<num_threads; i++) {
+    workers.emplace_back(&ThreadPool::worker_loop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::run(size_t n, size_t chunk_size, std::function<void(size_t, size_t)> func) {
+  if (n == 0) { return; }
+
+  if (chunk_size == 0) {
+    // A few chunks per thread, so that stealing can even out the load.
+    chunk_size = std::max<size_t>(1, n/(8*num_threads()));
+  }
+  size_t num_chunks = (n + chunk_size - 1)/chunk_size;
+
+  if (workers.empty() || num_chunks == 1 || inside_parallel_for) {
+    func(0, n);
+    return;
+  }
+
+  std::lock_guard<std::mutex> run_lock(run_mutex);
+
+  auto num_shares = shares.size();
+  for (auto i=0u; i<num_shares; i++) {
+    std::lock_guard<std::mutex> lock(shares[i]->mutex);
+    shares[i]->front = num_chunks*i/num_shares;
+    shares[i]->back = num_chunks*(i+1)/num_shares;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task = &func;
+    task_size = n;
+    task_chunk_size = chunk_size;
+    error = nullptr;
+    failed = false;
+    busy_workers = workers.size();
+    generation++;
+  }
+  wake.notify_all();
+
+  inside_parallel_for = true;
+  work(0);
+  inside_parallel_for = false;
+
+  // Every worker takes part in every loop, even if only to find no
+  // chunks left, so that none can still be reading the task after
+  // this returns.
+  std::exception_ptr loop_error;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return busy_workers == 0; });
+    task = nullptr;
+    std::swap(loop_error, error);
+  }
+
+  if (loop_error) {
+    std::rethrow_exception(loop_error);
+  }
+}
+
+void ThreadPool::worker_loop(unsigned int index) {
+  inside_parallel_for = true;
+  unsigned long seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&]() { return stopping || generation != seen; });
+      if (stopping) { return; }
+      seen = generation;
+    }
+
+    work(index);
+
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      last = (--busy_workers == 0);
+    }
+    if (last) {
+      done.notify_one();
+    }
+  }
+}
+
+void ThreadPool::work(unsigned int index) {
+  size_t chunk;
+  while (take_chunk(index, chunk)) {
+    if (failed) { continue; }
+
+    size_t begin = chunk*task_chunk_size;
+    size_t end = std::min(begin + task_chunk_size, task_size);
+    try {
+      (*task)(begin, end);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      failed = true;
+    }
+  }
+}
+
+bool ThreadPool::take_chunk(unsigned int index, size_t& chunk) {
+  {
+    auto& own = *shares[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (own.front < own.back) {
+      chunk = own.front++;
+      return true;
+    }
+  }
+
+  // Steal from the back, away from where the owner is working.
+  auto num_shares = shares.size();
+  for (auto i=1u; i<num_shares; i++) {
+    auto& other = *shares[(index + i) % num_shares];
+    std::lock_guard<std::mutex> lock(other.mutex);
+    if (other.front < other.back) {
+      chunk = --other.back;
+      return true;
+    }
+  }
+
+  return false;
+}
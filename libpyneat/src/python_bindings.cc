@@ -90,11 +90,19 @@ PYBIND11_PLUGIN(pyneat) {
     .def_readwrite("mutation_prob_toggle_connection",&Probabilities::mutation_prob_toggle_connection)
     .def_readwrite("genetic_distance_structural",&Probabilities::genetic_distance_structural)
     .def_readwrite("genetic_distance_weights",&Probabilities::genetic_distance_weights)
-    .def_readwrite("genetic_distance_species_threshold",&Probabilities::genetic_distance_species_threshold);
+    .def_readwrite("genetic_distance_species_threshold",&Probabilities::genetic_distance_species_threshold)
+    .def_readwrite("fitness_sharing",&Probabilities::fitness_sharing)
+    .def_readwrite("fitness_sharing_samples",&Probabilities::fitness_sharing_samples);
+
+  py::enum_<FitnessSharing>(m, "FitnessSharing")
+    .value("Exact",FitnessSharing::Exact)
+    .value("Sampled",FitnessSharing::Sampled);
 
   py::class_<ReachabilityChecker>(m, "ReachabilityChecker")
     .def(py::init<size_t>())
     .def(py::init<size_t, size_t>())
+    .def("AddNode",&ReachabilityChecker::AddNode)
+    .def("NumNodes",&ReachabilityChecker::NumNodes)
     .def("AddConnection",&ReachabilityChecker::AddConnection)
     .def("HasConnection",&ReachabilityChecker::HasConnection)
     .def("HasNormalConnection",&ReachabilityChecker::HasNormalConnection)
@@ -111,19 +119,27 @@ PYBIND11_PLUGIN(pyneat) {
     .value("Hidden",NodeType::Hidden)
     .value("Bias",NodeType::Bias);
 
+  py::enum_<Activation>(m, "Activation")
+    .value("Logistic",Activation::Logistic)
+    .value("LogisticFast",Activation::LogisticFast)
+    .value("Tanh",Activation::Tanh);
+
   py::class_<Genome>(m, "Genome")
     .def(py::init<>())
     .def("AddNode",&Genome::AddNode)
     .def("AddConnection",&Genome::AddConnection)
     .def("Size",&Genome::Size)
+    .def("StructuralHash",&Genome::StructuralHash)
     .def_static("ConnectedSeed", &Genome::ConnectedSeed);
 
   py::class_<NeuralNet>(m, "NeuralNet")
-    .def("evaluate", &NeuralNet::evaluate)
+    .def("evaluate",
+         (std::vector<_float_> (NeuralNet::*)(const std::vector<_float_>&))&NeuralNet::evaluate)
     .def_property_readonly("num_nodes", &NeuralNet::num_nodes)
     .def_property_readonly("num_connections", &NeuralNet::num_connections)
     .def("get_node_type",&NeuralNet::get_node_type)
     .def("get_connection",&NeuralNet::get_connection)
+    .def_property("activation", &NeuralNet::get_activation, &NeuralNet::set_activation)
     .def_property_readonly("node_types",
                            [](NeuralNet& net){
                              std::vector<NodeType> node_types;
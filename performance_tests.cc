@@ -108,16 +108,28 @@ int main(int argc, char** argv) {
     }
   } std:: cout << tperformance/1.0e6 << " ms" << " for construction of all networks individually. " << std::endl;
 
+  //----------------------------------------------------------------------------------
+  tperformance = 0.0;
+  std::vector<std::unique_ptr<NeuralNet>> xor_cached_networks;
+  xor_cached_networks.reserve(xor_genomes.size());
+  {
+    NetworkCache<ConcurrentNeuralNet> cache;
+    Timer teval([&tperformance](auto elapsed) { tperformance+=elapsed; });
+    for (auto& genome : xor_genomes) {
+      xor_cached_networks.emplace_back(cache.MakeNet(*genome));
+    }
+  } std:: cout << tperformance/1.0e6 << " ms" << " for construction and sorting of all networks through a NetworkCache. " << std::endl;
+
   //----------------------------------------------------------------------------------
   std::vector<_float_> inputs = {1.,1.};
-  std::vector<_float_> outputs;
-  outputs = xor_composite_net->evaluate(inputs);
+  std::vector<_float_> outputs(xor_composite_net->num_outputs());
+  xor_composite_net->evaluate(inputs, outputs);
   dummy(outputs);
 
   tperformance = 0.0;
   for (auto i=0u; i<num_trials; i++ ){
     Timer teval([&tperformance](auto elapsed) { tperformance+=elapsed; });
-    outputs = xor_composite_net->evaluate(inputs);
+    xor_composite_net->evaluate(inputs, outputs);
     dummy(outputs);
   } std:: cout << tperformance/num_trials/1.0e6 << " ms" << " for composite net evaluation. " << std::endl;
   std::vector<_float_> gpuoutputs = std::move(outputs);
@@ -127,7 +139,8 @@ int main(int argc, char** argv) {
   std::vector<_float_> cpuoutputs;
   cpuoutputs.reserve(gpuoutputs.size());
   for (auto& net : xor_networks) {
-    outputs = net->evaluate(inputs);
+    outputs.resize(net->num_outputs());
+    net->evaluate(inputs, outputs);
     std::copy(outputs.begin(),outputs.end(),std::back_inserter(cpuoutputs));
   }
   dummy(outputs);
@@ -135,7 +148,7 @@ int main(int argc, char** argv) {
   for (auto i=0u; i<num_trials; i++ ){
     Timer teval([&tperformance](auto elapsed) { tperformance+=elapsed; });
     for (auto& net : xor_networks) {
-      outputs = net->evaluate(inputs);
+      net->evaluate(inputs, outputs);
     }
     dummy(outputs);
   } std:: cout << tperformance/num_trials/1.0e6 << " ms" << " for evaluation of all networks individually. " << std::endl;
@@ -1,4 +1,6 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <set>
 #include "Genome.hh"
 #include "ConsecutiveNeuralNet.hh"
 #include "Timer.hh"
@@ -195,3 +197,132 @@ TEST(Genome, ConnectionOrder) {
   auto child = mother.MateWith(father);
   child.AssertNoDuplicateConnections();
 }
+
+TEST(Genome, GeneticDistanceIsSymmetric) {
+  auto prob = std::make_shared<Probabilities>();
+  prob->mutation_prob_add_connection = 0.9;
+  prob->mutation_prob_add_node = 0.3;
+
+  auto mother = Genome::ConnectedSeed(4, 2);
+  mother.set_generator(std::make_shared<RNG_MersenneTwister>());
+  mother.required(prob);
+  for (int i=0; i<50; i++) {
+    mother.Mutate();
+  }
+
+  auto father = mother;
+  for (int i=0; i<20; i++) {
+    father.Mutate();
+  }
+
+  // Shared genes are visited in the same order from either side.
+  EXPECT_EQ(mother.GeneticDistance(father), father.GeneticDistance(mother));
+  EXPECT_GT(mother.GeneticDistance(father), 0);
+  EXPECT_EQ(mother.GeneticDistance(mother), 0);
+
+  // Keeping the unmatched genes of both parents gives their union.
+  prob->keep_non_matching_father_gene = 1.0;
+  auto child = mother.MateWith(father);
+  child.AssertNoDuplicateConnections();
+  EXPECT_GE(child.Size(), std::max(mother.Size(), father.Size()));
+}
+
+TEST(Genome, CopiesShareNodes) {
+  auto mother = Genome::ConnectedSeed(4, 2);
+  mother.set_generator(std::make_shared<RNG_MersenneTwister>());
+  mother.required(std::make_shared<Probabilities>());
+
+  auto alone = mother.MemoryUsage();
+  auto num_nodes = mother.MakeNet<ConsecutiveNeuralNet>()->num_nodes();
+  {
+    auto copy = mother;
+    EXPECT_LT(mother.MemoryUsage(), alone);
+
+    // Adding a node copies the table, leaving the mother's untouched.
+    copy.MutateNode();
+    EXPECT_EQ(copy.Size(), mother.Size() + 2);
+    EXPECT_EQ(mother.MemoryUsage(), alone);
+    EXPECT_EQ(mother.MakeNet<ConsecutiveNeuralNet>()->num_nodes(), num_nodes);
+    EXPECT_EQ(copy.MakeNet<ConsecutiveNeuralNet>()->num_nodes(), num_nodes + 1);
+  }
+  EXPECT_EQ(mother.MemoryUsage(), alone);
+}
+
+TEST(Genome, ReachabilityCheckerAddNode) {
+  // Connections between 2 inputs and 4 other nodes, the last two of
+  // which are added to the growing checker just before first used.
+  std::vector<std::pair<size_t,size_t> > connections = {
+    {0,2}, {1,3}, {2,3}, {3,4}, {4,2}, {4,5}, {5,5}, {1,5}
+  };
+
+  ReachabilityChecker expected(6, 2);
+  ReachabilityChecker growing(4, 2);
+  for(auto& conn : connections) {
+    while(std::max(conn.first, conn.second) >= growing.NumNodes()) {
+      growing.AddNode();
+    }
+    expected.AddConnection(conn.first, conn.second);
+    growing.AddConnection(conn.first, conn.second);
+  }
+
+  ASSERT_EQ(growing.NumNodes(), expected.NumNodes());
+  EXPECT_EQ(growing.NumPossibleNormalConnections(), expected.NumPossibleNormalConnections());
+  EXPECT_EQ(growing.NumPossibleRecurrentConnections(), expected.NumPossibleRecurrentConnections());
+  for(size_t i=0; i<expected.NumNodes(); i++) {
+    for(size_t j=0; j<expected.NumNodes(); j++) {
+      EXPECT_EQ(growing.HasNormalConnection(i,j), expected.HasNormalConnection(i,j));
+      EXPECT_EQ(growing.HasRecurrentConnection(i,j), expected.HasRecurrentConnection(i,j));
+      EXPECT_EQ(growing.IsReachableNormal(i,j), expected.IsReachableNormal(i,j));
+      EXPECT_EQ(growing.IsReachableEither(i,j), expected.IsReachableEither(i,j));
+    }
+  }
+}
+
+namespace {
+  // Always returns the same value, to pick a given candidate.
+  class FixedRNG : public RNG {
+  public:
+    FixedRNG(double value) : value(value) { }
+    double uniform(double min, double max) { return min + value*(max-min); }
+    double gaussian(double mean, double) { return mean; }
+    double value;
+  };
+}
+
+TEST(Genome, ReachabilityCheckerCandidates) {
+  // Connections of nodes at most 50 apart, too dense for random
+  // guesses to find a normal connection, and spanning several words.
+  const size_t num_nodes = 130;
+  const size_t num_inputs = 3;
+  ReachabilityChecker checker(num_nodes, num_inputs);
+  for(size_t i=0; i<num_nodes; i++) {
+    for(size_t j=std::max(i+1, num_inputs); j<std::min(i+50, num_nodes); j++) {
+      checker.AddConnection(i, j);
+    }
+  }
+  checker.AddConnection(100, 20);
+
+  std::set<std::pair<int,int> > expected;
+  size_t num_recurrent = 0;
+  for(size_t i=0; i<num_nodes; i++) {
+    for(size_t j=num_inputs; j<num_nodes; j++) {
+      if(!checker.HasConnection(i,j)) {
+        if(checker.IsReachableNormal(j,i)) {
+          num_recurrent++;
+        } else {
+          expected.insert({i,j});
+        }
+      }
+    }
+  }
+  ASSERT_EQ(checker.NumPossibleNormalConnections(), expected.size());
+  EXPECT_EQ(checker.NumPossibleRecurrentConnections(), num_recurrent);
+
+  // Each index picks a different candidate.
+  std::set<std::pair<int,int> > picked;
+  for(size_t k=0; k<expected.size(); k++) {
+    FixedRNG rng((k + 0.5)/expected.size());
+    picked.insert(checker.RandomNormalConnection(rng));
+  }
+  EXPECT_EQ(picked, expected);
+}
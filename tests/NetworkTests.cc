@@ -5,6 +5,11 @@
 #include "ConcurrentNeuralNet.hh"
 #include "ConcurrentGPUNeuralNet.hh"
 #include "CompositeNet.hh"
+#include "NetworkCache.hh"
+#include "ConnectionScheduler.hh"
+#include "ExecutionPlan.hh"
+#include "PopulationBatchNet.hh"
+#include "Kernels.hh"
 #include "Timer.hh"
 
 template <typename To, typename From, typename Deleter>
@@ -225,6 +230,292 @@ TEST(ConcurrentNeuralNet,EvaluateLargeNetwork){
 
 }
 
+TEST(ConcurrentNeuralNet,EvaluateBatch) {
+  auto genome = Genome()
+    .AddNode(NodeType::Bias)
+    .AddNode(NodeType::Input)
+    .AddNode(NodeType::Input)
+    .AddNode(NodeType::Output)
+    .AddNode(NodeType::Hidden)
+    .AddNode(NodeType::Hidden)
+    .AddConnection(0,3,true,1.)
+    .AddConnection(1,5,true,1.12)
+    .AddConnection(2,4,true,-0.7)
+    .AddConnection(5,5,true,0.44) // self-recurrent
+    .AddConnection(5,3,true,-1.23)
+    .AddConnection(4,3,true,3.3)
+    .AddConnection(3,4,true,-0.8); // recurrent
+
+  std::vector<std::vector<_float_>> rows = {{0.5,1.5}, {-1.0,0.25}, {0.0,0.0}};
+
+  auto batch_net = genome.MakeNet<ConcurrentNeuralNet>();
+  auto& batch = static_cast<ConcurrentNeuralNet&>(*batch_net);
+  std::vector<std::unique_ptr<NeuralNet>> single_nets;
+  std::vector<_float_> inputs;
+  for(auto& row : rows) {
+    single_nets.push_back(genome.MakeNet<ConcurrentNeuralNet>());
+    inputs.insert(inputs.end(), row.begin(), row.end());
+  }
+
+  // Repeated evaluation exercises the per-row recurrent state
+  for(int step=0; step<3; step++) {
+    auto batch_result = batch.evaluate_batch(inputs, rows.size());
+    ASSERT_EQ(batch_result.size(), rows.size());
+    for(auto b=0u; b<rows.size(); b++) {
+      auto result = single_nets[b]->evaluate(rows[b]);
+      EXPECT_FLOAT_EQ(result[0], batch_result[b]);
+    }
+  }
+}
+
+TEST(ConcurrentNeuralNet,ConnectionSets) {
+  std::vector<Connection> connections = {
+    {2,3,ConnectionType::Normal,1.,0},
+    {3,2,ConnectionType::Recurrent,1.,0},
+    {0,3,ConnectionType::Normal,1.,0},
+    {3,3,ConnectionType::Recurrent,1.,0},
+    {1,2,ConnectionType::Normal,1.,0},
+  };
+  schedule_connection_sets(connections.data(), connections.size());
+
+  // The hidden and output nodes must be read recurrently before they
+  // are overwritten, and written completely before they are read.
+  struct Expected { unsigned int origin; unsigned int dest; unsigned int set; };
+  std::vector<Expected> expected = {
+    {3,2,0}, {3,3,1}, {1,2,1}, {2,3,2}, {0,3,3}
+  };
+  ASSERT_EQ(connections.size(), expected.size());
+  for(auto i=0u; i<connections.size(); i++) {
+    EXPECT_EQ(connections[i].origin, expected[i].origin);
+    EXPECT_EQ(connections[i].dest, expected[i].dest);
+    EXPECT_EQ(connections[i].set, expected[i].set);
+  }
+}
+
+TEST(ConcurrentNeuralNet,ExecutionPlan) {
+  auto genome = Genome()
+    .AddNode(NodeType::Bias)
+    .AddNode(NodeType::Input)
+    .AddNode(NodeType::Output)
+    .AddNode(NodeType::Hidden)
+    .AddConnection(1,3,true,1.)
+    .AddConnection(3,2,true,1.)
+    .AddConnection(0,2,true,1.);
+  auto net = genome.MakeNet<ConcurrentNeuralNet>();
+  net->sort_connections();
+
+  std::vector<NodeType> node_types;
+  std::vector<Connection> connections;
+  for(auto i=0u; i<net->num_nodes(); i++) {
+    node_types.push_back(net->get_node_type(i));
+  }
+  for(auto i=0u; i<net->num_connections(); i++) {
+    connections.push_back(net->get_connection(i));
+  }
+
+  ExecutionPlan plan(node_types, connections);
+  EXPECT_EQ(plan.num_connections(), 3u);
+  // Both connections into the output need their own level.
+  ASSERT_EQ(plan.num_levels(), 3u);
+  EXPECT_EQ(plan.level_size(0), 1u);
+  EXPECT_EQ(plan.level_size(1), 1u);
+  EXPECT_EQ(plan.level_size(2), 1u);
+  EXPECT_EQ(plan.input_nodes(), std::vector<unsigned int>{1});
+  EXPECT_EQ(plan.output_nodes(), std::vector<unsigned int>{2});
+  EXPECT_EQ(plan.bias_nodes(), std::vector<unsigned int>{0});
+
+  // The hidden node is activated before it is read, the output
+  // node after all connections have been applied.
+  EXPECT_EQ(plan.num_sigmoid(1), 1u);
+  EXPECT_EQ(plan.sigmoid_nodes(1)[0], 3u);
+  EXPECT_EQ(plan.num_sigmoid(3), 1u);
+  EXPECT_EQ(plan.sigmoid_nodes(3)[0], 2u);
+}
+
+TEST(ConcurrentNeuralNet,EvaluateWithoutConnections) {
+  auto genome = Genome()
+    .AddNode(NodeType::Bias)
+    .AddNode(NodeType::Input)
+    .AddNode(NodeType::Output);
+  auto net = genome.MakeNet<ConcurrentNeuralNet>();
+  auto result = net->evaluate({0.5});
+  ASSERT_EQ(result.size(), 1u);
+  EXPECT_FLOAT_EQ(result[0], 0.5);
+}
+
+TEST(ConcurrentNeuralNet,ApplyConnectionsKernel) {
+  // Conflict-free level: every node is written at most once, and
+  // nodes written are never read, except by a self-recurrent connection.
+  const unsigned int num_nodes = 200;
+  std::vector<unsigned int> origin;
+  std::vector<unsigned int> dest;
+  std::vector<_float_> weight;
+  for(auto i=0u; i<num_nodes/2; i++) {
+    unsigned int to = num_nodes/2 + (i*37)%(num_nodes/2);
+    unsigned int from = (i%7 == 0) ? to : (i*13)%(num_nodes/2);
+    origin.push_back(from);
+    dest.push_back(to);
+    weight.push_back(0.01*i - 0.3);
+  }
+
+  std::vector<_float_> initial(num_nodes);
+  for(auto i=0u; i<num_nodes; i++) {
+    initial[i] = std::sin(0.1*i);
+  }
+
+  // odd lengths to exercise the scalar tail of the vector kernels
+  for(unsigned int n : {0u, 5u, 16u, 37u, num_nodes/2}) {
+    auto expected = initial;
+    auto result = initial;
+    kernel_apply_connections_scalar(expected.data(), origin.data(), dest.data(), weight.data(), n);
+    kernel_apply_connections(result.data(), origin.data(), dest.data(), weight.data(), n);
+    for(auto i=0u; i<num_nodes; i++) {
+      // vector kernels may use a fused multiply-add
+      EXPECT_NEAR(result[i], expected[i], 1e-6) << kernel_instruction_set() << ", n = " << n << ", node " << i;
+    }
+  }
+}
+
+TEST(ConcurrentNeuralNet,ActivationKernels) {
+  struct Bound { Activation activation; double max_error; double (*exact)(double); };
+  const Bound bounds[] = {
+    {Activation::Logistic, 1e-7, [](double x) { return 1/(1 + std::exp(-x)); }},
+    {Activation::LogisticFast, 5e-5, [](double x) { return 1/(1 + std::exp(-x)); }},
+    {Activation::Tanh, 2e-7, [](double x) { return std::tanh(x); }},
+  };
+
+  std::vector<_float_> inputs;
+  for(int i=-3000; i<=3000; i++) {
+    inputs.push_back(0.01f*i);
+  }
+  inputs.push_back(-1e6);
+  inputs.push_back(1e6);
+
+  // visit the values out of order, to exercise the gather and scatter
+  std::vector<unsigned int> list;
+  for(auto i=0u; i<inputs.size(); i++) {
+    list.push_back((i*7919u) % inputs.size());
+  }
+
+  for(auto& bound : bounds) {
+    auto contiguous = inputs;
+    auto indexed = inputs;
+    kernel_activate(bound.activation, contiguous.data(), contiguous.size());
+    kernel_activate(bound.activation, indexed.data(), list.data(), list.size());
+    for(auto i=0u; i<inputs.size(); i++) {
+      double exact = bound.exact(inputs[i]);
+      EXPECT_NEAR(contiguous[i], exact, bound.max_error) << kernel_instruction_set() << ", x = " << inputs[i];
+      EXPECT_NEAR(kernel_activate(bound.activation, inputs[i]), exact, bound.max_error) << "x = " << inputs[i];
+      EXPECT_EQ(indexed[i], contiguous[i]) << kernel_instruction_set() << ", x = " << inputs[i];
+    }
+  }
+
+  ConcurrentNeuralNet net;
+  net.add_node(NodeType::Input);
+  net.add_node(NodeType::Output);
+  net.add_connection(0, 1, 1.0);
+  net.set_activation(Activation::Tanh);
+  EXPECT_NEAR(net.evaluate({-0.5})[0], std::tanh(-0.5), 2e-7);
+}
+
+template<typename NetType>
+void ExpectSpanMatchesVector() {
+  NetType by_vector;
+  NetType by_span;
+  for(auto net : {(NeuralNet*)&by_vector, (NeuralNet*)&by_span}) {
+    net->add_node(NodeType::Input);
+    net->add_node(NodeType::Input);
+    net->add_node(NodeType::Output);
+    net->add_node(NodeType::Output);
+    net->add_connection(0, 2, 0.5);
+    net->add_connection(1, 3, -1.5);
+    net->add_connection(2, 3, 2.0);
+    net->add_connection(3, 2, 0.25);
+  }
+  EXPECT_EQ(by_span.num_outputs(), 2u);
+
+  // write the outputs into the middle of a larger buffer
+  std::vector<_float_> inputs = {0.3, 0.7};
+  std::vector<_float_> buffer(4, -1);
+  for(int i=0; i<3; i++) {
+    auto expected = by_vector.evaluate(inputs);
+    by_span.evaluate(inputs, Span<_float_>(buffer).subspan(1, 2));
+    EXPECT_EQ(buffer[0], -1);
+    EXPECT_EQ(buffer[1], expected[0]);
+    EXPECT_EQ(buffer[2], expected[1]);
+    EXPECT_EQ(buffer[3], -1);
+  }
+}
+
+TEST(NeuralNet,EvaluateIntoSpan) {
+  ExpectSpanMatchesVector<ConcurrentNeuralNet>();
+  ExpectSpanMatchesVector<ConsecutiveNeuralNet>();
+}
+
+struct ScaledIdentity {
+  _float_ operator()(_float_ x) const { return 2*x; }
+};
+
+template<typename NetType>
+std::vector<_float_> EvaluateChain(_float_ input) {
+  // input -> hidden -> output, with a recurrent connection back to the hidden node
+  NetType net;
+  net.add_node(NodeType::Input);
+  net.add_node(NodeType::Hidden);
+  net.add_node(NodeType::Output);
+  net.add_connection(0, 1, 1.5);
+  net.add_connection(1, 2, -0.75);
+  net.add_connection(2, 1, 0.5);
+  std::vector<_float_> outputs;
+  for(int i=0; i<3; i++) {
+    outputs.push_back(net.evaluate({input})[0]);
+  }
+  return outputs;
+}
+
+template<typename Policy>
+void ExpectPolicyMatches(Policy policy, _float_ input) {
+  _float_ output = 0;
+  std::vector<_float_> expected;
+  for(int i=0; i<3; i++) {
+    _float_ hidden = policy(1.5f*input + 0.5f*output);
+    output = policy(-0.75f*hidden);
+    expected.push_back(output);
+  }
+
+  auto concurrent = EvaluateChain<BasicConcurrentNeuralNet<Policy> >(input);
+  auto consecutive = EvaluateChain<BasicConsecutiveNeuralNet<Policy> >(input);
+  for(int i=0; i<3; i++) {
+    EXPECT_FLOAT_EQ(concurrent[i], expected[i]);
+    EXPECT_FLOAT_EQ(consecutive[i], expected[i]);
+  }
+}
+
+TEST(NeuralNet,ActivationPolicy) {
+  for(_float_ input : {-2.0f, 0.3f, 4.0f}) {
+    ExpectPolicyMatches(LogisticActivation(), input);
+    ExpectPolicyMatches(TanhActivation(), input);
+    ExpectPolicyMatches(SoftsignActivation(), input);
+    ExpectPolicyMatches(ReLUActivation(), input);
+    ExpectPolicyMatches(ScaledIdentity(), input);
+  }
+
+  // The default policy matches the logistic functor
+  auto runtime = EvaluateChain<ConcurrentNeuralNet>(0.3);
+  auto logistic = EvaluateChain<BasicConcurrentNeuralNet<LogisticActivation> >(0.3);
+  for(int i=0; i<3; i++) {
+    EXPECT_NEAR(runtime[i], logistic[i], 1e-6);
+  }
+
+  // A registered sigmoid overrides the policy
+  BasicConcurrentNeuralNet<ReLUActivation> net;
+  net.add_node(NodeType::Input);
+  net.add_node(NodeType::Output);
+  net.add_connection(0, 1, -1.0);
+  net.register_sigmoid([](_float_ x) { return x; });
+  EXPECT_FLOAT_EQ(net.evaluate({0.5})[0], -0.5);
+}
+
 template<typename Derived, typename Base, typename Del>
 std::unique_ptr<Derived, Del>
 static_unique_ptr_cast( std::unique_ptr<Base, Del>&& p )
@@ -448,3 +739,306 @@ TEST(NeuralNet,CompositeNet) {
   }
 
 }
+
+TEST(NeuralNet,PopulationBatchNet) {
+  auto seed = Genome()
+    .AddNode(NodeType::Bias)
+    .AddNode(NodeType::Input)
+    .AddNode(NodeType::Input)
+    .AddNode(NodeType::Output)
+    .AddNode(NodeType::Hidden)
+    .AddNode(NodeType::Hidden)
+    .AddConnection(1,5,true,1.12)
+    .AddConnection(2,4,true,9.9)
+    .AddConnection(5,5,true,0.44) // self-recurrent
+    .AddConnection(5,3,true,-1.23)
+    .AddConnection(4,3,true,3.3)
+    .AddConnection(3,4,true,-8.2); // recurrent
+
+  seed.set_generator(std::make_shared<RNG_MersenneTwister>());
+  seed.required(std::make_shared<Probabilities>());
+
+  // The batch is built from consecutive nets, and compared against
+  // concurrent nets, which apply connections in the same order.
+  PopulationBatchNet batch;
+  std::vector<std::unique_ptr<NeuralNet>> single_nets;
+  for (auto i=0u; i<20; i++) {
+    Genome genome(seed);
+    for (auto n=0u; n<i%5; n++) {
+      genome.Mutate();
+    }
+    auto source = genome.MakeNet<ConsecutiveNeuralNet>();
+    EXPECT_EQ(batch.add_network(*source), i);
+    single_nets.push_back(genome.MakeNet<ConcurrentNeuralNet>());
+  }
+  ASSERT_EQ(batch.num_networks(), single_nets.size());
+  ASSERT_EQ(batch.num_inputs(), 2*single_nets.size());
+  ASSERT_EQ(batch.num_outputs(), single_nets.size());
+
+  // On odd steps, only every third network is evaluated.
+  std::vector<_float_> inputs(batch.num_inputs());
+  std::vector<_float_> outputs(batch.num_outputs());
+  std::vector<bool> active(batch.num_networks());
+  for (auto step=0u; step<6; step++) {
+    for (auto i=0u; i<inputs.size(); i++) {
+      inputs[i] = std::sin(0.7*i + step);
+    }
+    for (auto k=0u; k<active.size(); k++) {
+      active[k] = step%2 == 0 || k%3 == 0;
+    }
+    batch.evaluate(inputs, outputs, active);
+
+    for (auto k=0u; k<single_nets.size(); k++) {
+      if (!active[k]) {
+        continue;
+      }
+      auto first = inputs.begin() + batch.input_offset(k);
+      auto expected = single_nets[k]->evaluate({first, first + batch.num_inputs(k)});
+      ASSERT_EQ(expected.size(), batch.num_outputs(k));
+      EXPECT_FLOAT_EQ(outputs[batch.output_offset(k)], expected[0]) << "network " << k << ", step " << step;
+    }
+  }
+}
+
+TEST(NeuralNet,LoopDetection) {
+  ConsecutiveNeuralNet net;
+  net.add_node(NodeType::Input);
+  for(int i=0; i<4; i++) {
+    net.add_node(NodeType::Hidden);
+  }
+
+  // 0 -> 1 -> 2 -> 3, then connections closing loops are recurrent.
+  net.add_connection(0,1,1.0);
+  net.add_connection(1,2,1.0);
+  net.add_connection(2,3,1.0);
+  net.add_connection(3,1,1.0);
+  net.add_connection(2,2,1.0);
+  net.add_connection(1,3,1.0);
+  EXPECT_EQ(net.get_connection(3).type, ConnectionType::Recurrent);
+  EXPECT_EQ(net.get_connection(4).type, ConnectionType::Recurrent);
+  EXPECT_EQ(net.get_connection(5).type, ConnectionType::Normal);
+
+  // Within a set, only the connections of that set are followed.
+  net.add_connection(3,4,1.0,7);
+  net.add_connection(4,2,1.0,7);
+  EXPECT_EQ(net.get_connection(6).type, ConnectionType::Normal);
+  EXPECT_EQ(net.get_connection(7).type, ConnectionType::Normal);
+  net.add_connection(2,3,1.0,7);
+  EXPECT_EQ(net.get_connection(8).type, ConnectionType::Recurrent);
+}
+
+// Seed genome with 3 inputs and 2 outputs, grown by adding nodes and connections
+Genome MutatedGenome(unsigned long seed, int steps) {
+  auto genome = Genome::ConnectedSeed(3,2);
+  genome.set_generator(std::make_shared<RNG_MersenneTwister>(seed));
+  genome.required(std::make_shared<Probabilities>());
+  for (int i=0; i<steps; i++) {
+    genome.MutateNode();
+    genome.MutateConnection();
+  }
+  return genome;
+}
+
+TEST(NeuralNet,AddClassifiedConnections) {
+  auto genome = MutatedGenome(7, 200);
+  for(int i=0; i<200; i++) {
+    genome.MutateToggleGeneStatus();
+  }
+
+  // MakeNet takes the types from the genome, rather than finding loops
+  // again, and should agree with a network finding them itself.
+  auto net = genome.MakeNet<ConsecutiveNeuralNet>();
+  ConsecutiveNeuralNet replayed;
+  for(auto i=0u; i<net->num_nodes(); i++) {
+    replayed.add_node(net->get_node_type(i));
+  }
+  for(auto i=0u; i<net->num_connections(); i++) {
+    auto conn = net->get_connection(i);
+    replayed.add_connection(conn.origin, conn.dest, conn.weight);
+  }
+
+  ASSERT_EQ(replayed.num_connections(), net->num_connections());
+  int num_recurrent = 0;
+  for(auto i=0u; i<net->num_connections(); i++) {
+    EXPECT_EQ(net->get_connection(i).type, replayed.get_connection(i).type);
+    num_recurrent += net->get_connection(i).type == ConnectionType::Recurrent;
+  }
+  EXPECT_GT(num_recurrent, 0);
+}
+
+TEST(NeuralNet,ThreadedCompositeNet) {
+  std::vector<Genome> genomes;
+  std::vector<Genome*> pointers;
+  for (auto i=0u; i<40; i++) {
+    genomes.push_back(MutatedGenome(11+i, 20));
+    genomes.back().RandomizeWeights();
+  }
+  for (auto& genome : genomes) {
+    pointers.push_back(&genome);
+  }
+
+  ThreadPool pool(4);
+  auto serial = BuildCompositeNet<ConcurrentNeuralNet>(pointers,false);
+  auto threaded = BuildCompositeNet<ConcurrentNeuralNet>(pointers,false,&pool);
+  ASSERT_EQ(threaded->num_connections(), serial->num_connections());
+
+  std::vector<_float_> inputs = {0.5, -0.25, 1.0};
+  for (int step=0; step<5; step++) {
+    auto expected = serial->evaluate(inputs);
+    auto result = threaded->evaluate(inputs);
+    ASSERT_EQ(result.size(), expected.size());
+    for (auto i=0u; i<result.size(); i++) {
+      EXPECT_FLOAT_EQ(result[i], expected[i]);
+    }
+  }
+}
+
+TEST(NeuralNet,CompositeNetRebuild) {
+  std::vector<Genome> genomes;
+  std::vector<Genome*> pointers;
+  for (auto i=0u; i<30; i++) {
+    genomes.push_back(MutatedGenome(5+i, 10));
+  }
+  for (auto& genome : genomes) {
+    pointers.push_back(&genome);
+  }
+
+  CompositeNetBuilder<ConcurrentNeuralNet> builder;
+  std::vector<_float_> inputs = {0.5, -0.25, 1.0};
+  for (int generation=0; generation<4; generation++) {
+    auto rebuilt = builder.build(pointers,false);
+    auto fresh = BuildCompositeNet<ConcurrentNeuralNet>(pointers,false);
+    ASSERT_EQ(rebuilt->num_connections(), fresh->num_connections());
+
+    for (int step=0; step<5; step++) {
+      auto expected = fresh->evaluate(inputs);
+      auto result = rebuilt->evaluate(inputs);
+      ASSERT_EQ(result.size(), expected.size());
+      for (auto i=0u; i<result.size(); i++) {
+        EXPECT_FLOAT_EQ(result[i], expected[i]);
+      }
+    }
+
+    // most genomes keep their structure, a few change it
+    for (auto i=0u; i<genomes.size(); i++) {
+      genomes[i].RandomizeWeights();
+      if (i%5 == 0) {
+        genomes[i].MutateNode();
+        genomes[i].MutateConnection();
+      }
+    }
+  }
+  EXPECT_LE(builder.num_cached(), genomes.size());
+}
+
+template<typename NetType>
+void ExpectNetLikeMatchesMakeNet() {
+  auto parent = MutatedGenome(17, 15);
+  parent.MutateToggleGeneStatus();
+
+  // leave state behind in the parent's network
+  std::vector<_float_> inputs = {0.3, -0.7, 0.9};
+  auto parent_net = parent.MakeNet<NetType>();
+  for (int step=0; step<3; step++) {
+    parent_net->evaluate(inputs);
+  }
+
+  auto child = parent;
+  child.MutateWeights();
+  ASSERT_EQ(child.StructuralHash(), parent.StructuralHash());
+
+  auto expected_net = child.MakeNet<NetType>();
+  auto net = child.MakeNetLike(*parent_net);
+  ASSERT_EQ(net->num_connections(), expected_net->num_connections());
+  for (int step=0; step<5; step++) {
+    auto expected = expected_net->evaluate(inputs);
+    auto result = net->evaluate(inputs);
+    ASSERT_EQ(result.size(), expected.size());
+    for (auto i=0u; i<result.size(); i++) {
+      EXPECT_FLOAT_EQ(result[i], expected[i]);
+    }
+  }
+
+  // a genome of another structure is refused
+  auto other = parent;
+  other.MutateConnection();
+  other.MutateNode();
+  ASSERT_NE(other.StructuralHash(), parent.StructuralHash());
+  EXPECT_EQ(other.MakeNetLike(*parent_net), nullptr);
+}
+
+TEST(NeuralNet,MakeNetLike) {
+  ExpectNetLikeMatchesMakeNet<ConsecutiveNeuralNet>();
+  ExpectNetLikeMatchesMakeNet<ConcurrentNeuralNet>();
+}
+
+TEST(NeuralNet,NetworkCache) {
+  auto seed = MutatedGenome(23, 10);
+
+  NetworkCache<ConcurrentNeuralNet> cache(2);
+  std::vector<_float_> inputs = {0.1, 0.2, -0.4};
+
+  // weight-only variants share one structure
+  for (int i=0; i<3; i++) {
+    auto genome = seed;
+    genome.MutateWeights();
+    auto net = cache.MakeNet(genome);
+    auto expected_net = genome.MakeNet<ConcurrentNeuralNet>();
+    for (int step=0; step<3; step++) {
+      auto expected = expected_net->evaluate(inputs);
+      auto result = net->evaluate(inputs);
+      for (auto j=0u; j<result.size(); j++) {
+        EXPECT_FLOAT_EQ(result[j], expected[j]);
+      }
+    }
+  }
+  EXPECT_EQ(cache.Size(), 1u);
+
+  // the least recently used structure is dropped
+  auto other = seed;
+  other.MutateNode();
+  auto third = other;
+  third.MutateNode();
+  cache.MakeNet(other);
+  cache.MakeNet(third);
+  EXPECT_EQ(cache.Size(), 2u);
+
+  cache.SetCapacity(0);
+  EXPECT_EQ(cache.Size(), 0u);
+}
+
+template<typename NetType>
+void ExpectCopiesIndependent() {
+  auto genome = MutatedGenome(29, 10);
+
+  std::vector<_float_> inputs = {-0.2, 0.6, 0.4};
+  auto net = genome.MakeNet<NetType>();
+  auto expected_net = genome.MakeNet<NetType>();
+  net->evaluate(inputs);
+  expected_net->evaluate(inputs);
+
+  // the copy has its own node values and weights
+  auto copy = net->clone();
+  copy->reset_state();
+  std::vector<_float_> weights(copy->num_connections(), 0.5);
+  copy->set_weights(weights);
+
+  for (int step=0; step<3; step++) {
+    auto expected = expected_net->evaluate(inputs);
+    auto result = net->evaluate(inputs);
+    copy->evaluate(inputs);
+    ASSERT_EQ(result.size(), expected.size());
+    for (auto i=0u; i<result.size(); i++) {
+      EXPECT_FLOAT_EQ(result[i], expected[i]);
+    }
+  }
+  for (auto i=0u; i<net->num_connections(); i++) {
+    EXPECT_EQ(net->get_connection(i).weight, expected_net->get_connection(i).weight);
+    EXPECT_EQ(copy->get_connection(i).weight, 0.5);
+  }
+}
+
+TEST(NeuralNet,CopiesIndependent) {
+  ExpectCopiesIndependent<ConsecutiveNeuralNet>();
+  ExpectCopiesIndependent<ConcurrentNeuralNet>();
+}
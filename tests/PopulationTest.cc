@@ -2,6 +2,13 @@
 #include "Population.hh"
 #include "Timer.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
 TEST(Population,Construct){
   auto adam = Genome()
     .AddNode(NodeType::Bias)
@@ -125,3 +132,292 @@ TEST(Population, PruneEmptySpecies){
     EXPECT_EQ(gen2.GetSpecies()[1].id, 7u);
   }
 }
+
+namespace {
+  class SumOfOutputs : public FitnessEvaluator {
+  public:
+    void step(NetProxy& proxy) override {
+      if (num_steps < 4) {
+        proxy.request_calc({_float_(num_steps) - 1},
+                           [this](const std::vector<_float_>& outputs) { total += outputs[0]; });
+        num_steps++;
+      } else {
+        proxy.set_fitness_value(total);
+      }
+    }
+
+  private:
+    unsigned int num_steps = 0;
+    double total = 0;
+  };
+}
+
+namespace {
+  // Requests no inputs on some steps, which must leave the network's
+  // state as it was.
+  class SkippingSum : public FitnessEvaluator {
+  public:
+    explicit SkippingSum(unsigned int skip) : skip(skip) { ; }
+
+    void step(NetProxy& proxy) override {
+      if (num_steps < 6) {
+        if (num_steps % 3 != skip) {
+          proxy.request_calc({_float_(num_steps) - 2},
+                             [this](const std::vector<_float_>& outputs) { total += outputs[0]; });
+        }
+        num_steps++;
+      } else {
+        proxy.set_fitness_value(total);
+      }
+    }
+
+  private:
+    unsigned int skip;
+    unsigned int num_steps = 0;
+    double total = 0;
+  };
+}
+
+TEST(Population, BatchedEvaluation){
+  auto adam = Genome()
+    .AddNode(NodeType::Bias)
+    .AddNode(NodeType::Input)
+    .AddNode(NodeType::Hidden)
+    .AddNode(NodeType::Output)
+    .AddConnection(0,3,true,1.)
+    .AddConnection(1,3,true,1.)
+    .AddConnection(1,2,true,1.)
+    .AddConnection(2,3,true,1.)
+    .AddConnection(3,2,true,1.);
+
+  Population seed(adam,
+                  std::make_shared<RNG_MersenneTwister>(),
+                  std::make_shared<Probabilities>());
+
+  // Each comparison starts from networks without state.
+  auto expect_same_fitness = [&](std::function<std::unique_ptr<FitnessEvaluator>(void)> factory) {
+    Population sequential(seed);
+    Population batched(seed);
+    batched.EnableBatchNet();
+    sequential.Evaluate(factory);
+    batched.Evaluate(factory);
+
+    auto& expected = sequential.GetSpecies();
+    auto& actual = batched.GetSpecies();
+    ASSERT_EQ(expected.size(), actual.size());
+    for (auto i=0u; i<expected.size(); i++) {
+      ASSERT_EQ(expected[i].organisms.size(), actual[i].organisms.size());
+      for (auto j=0u; j<expected[i].organisms.size(); j++) {
+        EXPECT_NEAR(expected[i].organisms[j].fitness, actual[i].organisms[j].fitness, 1e-5);
+      }
+    }
+  };
+
+  expect_same_fitness([]() { return std::make_unique<SumOfOutputs>(); });
+
+  // Organisms skip different steps, each waiting while others run.
+  // Evaluate copies the factory, so each population counts from 0.
+  expect_same_fitness([num_made = 0u]() mutable { return std::make_unique<SkippingSum>(num_made++ % 4); });
+}
+
+TEST(Population, ThreadPool){
+  ThreadPool pool(4);
+  EXPECT_EQ(pool.num_threads(), 4u);
+
+  // Uneven work per index, so that threads steal from each other.
+  std::vector<int> visits(10000, 0);
+  pool.parallel_for(visits.size(), 7, [&](size_t begin, size_t end) {
+      EXPECT_LE(end - begin, 7u);
+      for (auto i=begin; i<end; i++) {
+        if (i % 1000 == 0) {
+          std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        visits[i]++;
+      }
+    });
+  for (auto count : visits) {
+    EXPECT_EQ(count, 1);
+  }
+
+  // Nested loops run serially instead of deadlocking.
+  std::atomic<int> total(0);
+  pool.parallel_for(8, 1, [&](size_t, size_t) {
+      pool.parallel_for(8, 1, [&](size_t begin, size_t end) { total += end - begin; });
+    });
+  EXPECT_EQ(total, 64);
+
+  EXPECT_THROW(pool.parallel_for(100, 1, [](size_t begin, size_t) {
+        if (begin == 50) { throw std::runtime_error("failed"); }
+      }), std::runtime_error);
+}
+
+TEST(Population, ThreadedEvaluation){
+  auto adam = Genome()
+    .AddNode(NodeType::Bias)
+    .AddNode(NodeType::Input)
+    .AddNode(NodeType::Hidden)
+    .AddNode(NodeType::Output)
+    .AddConnection(0,3,true,1.)
+    .AddConnection(1,3,true,1.)
+    .AddConnection(1,2,true,1.)
+    .AddConnection(2,3,true,1.)
+    .AddConnection(3,2,true,1.);
+
+  Population serial(adam,
+                    std::make_shared<RNG_MersenneTwister>(),
+                    std::make_shared<Probabilities>());
+  Population threaded(serial);
+  threaded.SetNumThreads(4);
+  EXPECT_EQ(serial.NumThreads(), 1u);
+  EXPECT_EQ(threaded.NumThreads(), 4u);
+
+  std::function<std::unique_ptr<FitnessEvaluator>(void)> factory =
+    []() { return std::make_unique<SumOfOutputs>(); };
+  serial.Evaluate(factory);
+  threaded.Evaluate(factory);
+
+  auto& expected = serial.GetSpecies();
+  auto& actual = threaded.GetSpecies();
+  ASSERT_EQ(expected.size(), actual.size());
+  for (auto i=0u; i<expected.size(); i++) {
+    ASSERT_EQ(expected[i].organisms.size(), actual[i].organisms.size());
+    for (auto j=0u; j<expected[i].organisms.size(); j++) {
+      EXPECT_EQ(expected[i].organisms[j].fitness, actual[i].organisms[j].fitness);
+    }
+  }
+
+  auto next = threaded.Reproduce();
+  EXPECT_EQ(next.NumThreads(), 4u);
+}
+
+TEST(Population, ThreadedReproduction){
+  auto evolve = [](unsigned int num_threads) {
+    auto adam = Genome::ConnectedSeed(2,1);
+    Population pop(adam,
+                   std::make_shared<RNG_MersenneTwister>(42),
+                   std::make_shared<Probabilities>());
+    pop.SetNumThreads(num_threads);
+
+    for (int gen=0; gen<5; gen++) {
+      pop = pop.Reproduce([](NeuralNet& net) {
+          return net.evaluate({1, 0})[0] + net.num_connections();
+        });
+    }
+
+    // Every gene, with weights to full precision, since most random
+    // numbers drawn for a child go to its weights.
+    std::stringstream ss;
+    ss << std::setprecision(17);
+    for (auto& spec : pop.GetSpecies()) {
+      ss << "Species " << spec.id << "\n";
+      for (auto& org : spec.organisms) {
+        for (auto& gene : org.genome.ConnectionGenes()) {
+          ss << gene.innovation << " " << gene.origin << " " << gene.dest << " "
+             << gene.enabled << " " << gene.weight << "\n";
+        }
+        ss << "\n";
+      }
+    }
+    return ss.str();
+  };
+
+  // Children are made and speciated on different threads, in a
+  // different order, but from the same parents and random numbers.
+  auto serial = evolve(1);
+  EXPECT_EQ(serial, evolve(4));
+  EXPECT_EQ(serial, evolve(3));
+}
+
+TEST(Population, FitnessSharing){
+  auto prob = std::make_shared<Probabilities>();
+  prob->population_size = 200;
+  prob->genetic_distance_species_threshold = 20.0;
+  auto adam = Genome::ConnectedSeed(3,2);
+
+  Population pop(adam, std::make_shared<RNG_MersenneTwister>(5), prob);
+  pop.SetNumThreads(4);
+  pop.Evaluate([](NeuralNet&) { return 1.0; });
+
+  // Each pair is compared once, and counted for both organisms.
+  for (auto& spec : pop.GetSpecies()) {
+    for (auto& org : spec.organisms) {
+      int nearby = 0;
+      for (auto& other : spec.organisms) {
+        if (org.genome.GeneticDistance(other.genome) < prob->genetic_distance_species_threshold) {
+          nearby++;
+        }
+      }
+      EXPECT_DOUBLE_EQ(org.adj_fitness, 1.0/nearby);
+    }
+  }
+
+  // Sampled counts are estimates, so they are checked on average over
+  // many seeds.  Weights 10 apart are at a distance of 2, so each
+  // genome of the first species is near the 9 weights either side of
+  // its own, and the near count differs across the species.  The
+  // weights are shuffled, so that neighbours in the species are far
+  // apart, and a sample of an organism itself would show.  The second
+  // species is near part of the first, so samples drawn outside the
+  // species would show.
+  prob->fitness_sharing = FitnessSharing::Sampled;
+  prob->fitness_sharing_samples = 10;
+  auto make_species = [&](unsigned int id, int size, int weight_stride, double weight_step) {
+    Species spec;
+    spec.id = id;
+    spec.age = 0;
+    spec.best_fitness = 0;
+    for (int i=0; i<size; i++) {
+      auto genome = Genome()
+        .AddNode(NodeType::Bias)
+        .AddNode(NodeType::Input)
+        .AddNode(NodeType::Output)
+        .AddConnection(0,2,true,1.0 + weight_step*(i*weight_stride % size))
+        .AddConnection(1,2,true,1.0 + weight_step*(i*weight_stride % size));
+      genome.required(prob);
+      spec.organisms.emplace_back(genome, genome.MakeNet<ConsecutiveNeuralNet>());
+    }
+    spec.representative = spec.organisms[0].genome;
+    return spec;
+  };
+  auto mixed = make_species(0, 40, 13, 10.0);
+  auto near = make_species(1, 15, 1, 0.0);
+
+  std::vector<double> exact(mixed.organisms.size(), 0);
+  for (auto i=0u; i<mixed.organisms.size(); i++) {
+    for (auto& other : mixed.organisms) {
+      if (mixed.organisms[i].genome.GeneticDistance(other.genome) < prob->genetic_distance_species_threshold) {
+        exact[i]++;
+      }
+    }
+  }
+  EXPECT_EQ(*std::min_element(exact.begin(), exact.end()), 10);
+  EXPECT_EQ(*std::max_element(exact.begin(), exact.end()), 19);
+
+  const int num_seeds = 1000;
+  std::vector<double> mean(mixed.organisms.size(), 0);
+  for (int seed=1; seed<=num_seeds; seed++) {
+    Population sampled({mixed, near}, std::make_shared<RNG_MersenneTwister>(seed), prob);
+    sampled.SetNumThreads(4);
+    sampled.Evaluate([](NeuralNet&) { return 1.0; });
+    auto& organisms = sampled.GetSpecies()[0].organisms;
+    for (auto i=0u; i<organisms.size(); i++) {
+      mean[i] += 1.0/organisms[i].adj_fitness/num_seeds;
+    }
+    // every sample within the second species is near
+    for (auto& org : sampled.GetSpecies()[1].organisms) {
+      ASSERT_DOUBLE_EQ(org.adj_fitness, 1.0/near.organisms.size());
+    }
+  }
+
+  // Each mean has a standard deviation of about 0.2, and their average
+  // of about 0.03.  Counting an organism as its own sample adds about 1
+  // to the average, and sampling the next species 0.25.
+  double total_mean = 0;
+  double total_exact = 0;
+  for (auto i=0u; i<mean.size(); i++) {
+    EXPECT_NEAR(mean[i], exact[i], 1.5) << "organism " << i;
+    total_mean += mean[i];
+    total_exact += exact[i];
+  }
+  EXPECT_NEAR(total_mean/mean.size(), total_exact/mean.size(), 0.15);
+}